@@ -0,0 +1,155 @@
+// Compare the acceleration structures on random sphere fields.
+//
+//   accel_bench [--sizes=1000,100000,1000000] [--rays=1000000]
+//               [--precision=double|float]
+//
+// Every structure traces the same rays (random origins inside the field,
+// random directions), so the hit counts printed next to the timings must
+// agree. HittableList is linear in the scene size, so it only traces enough
+// rays to keep each size to a few seconds.
+
+#include "BVH.h"
+#include "HittableList.h"
+#include "LinearBVH.h"
+#include "Sphere.h"
+#include "SphereSoA.h"
+#include "WideBVH.h"
+#include "cxxopts.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace {
+
+template <typename T> HittableList<T> sphere_field(size_t n) {
+  HittableList<T> world;
+  world.objects.reserve(n);
+  // Only intersection is timed, so every sphere can use material 0.
+  const uint32_t material = 0;
+  T side = T(2.0 * std::cbrt(double(n)));
+  for (size_t i = 0; i < n; ++i) {
+    Vec3<T> center = Vec3<T>::rand(0, side);
+    world.add(std::make_shared<Sphere<T>>(center, T(0.3), material));
+  }
+  return world;
+}
+
+template <typename T>
+std::vector<Ray<T>> random_rays(size_t n, T side) {
+  std::vector<Ray<T>> rays;
+  rays.reserve(n);
+  for (size_t i = 0; i < n; ++i)
+    rays.emplace_back(Vec3<T>::rand(0, side), random_unit_vector<T>());
+  return rays;
+}
+
+struct Result {
+  double seconds;
+  size_t hits;
+};
+
+template <typename T>
+Result trace(const Hittable<T> &world, const std::vector<Ray<T>> &rays,
+             size_t count) {
+  HitRecord<T> rec;
+  size_t hits = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < count; ++i)
+    hits += world.hit(rays[i], 0, std::numeric_limits<T>::infinity(), rec);
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return {elapsed.count(), hits};
+}
+
+template <typename F> double time_build(F &&build) {
+  auto start = std::chrono::steady_clock::now();
+  build();
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+void report(const char *name, size_t n, double build, const Result &res,
+            size_t rays) {
+  std::printf("%-12s %9zu %9.3f %10zu %9zu %12.3f\n", name, n, build, rays,
+              res.hits, rays / res.seconds * 1e-6);
+}
+
+template <typename T> void run(size_t n, size_t nRays) {
+  auto world = sphere_field<T>(n);
+  auto rays = random_rays<T>(nRays, T(2.0 * std::cbrt(double(n))));
+
+  // Scale the linear scan down so it does ~2e8 sphere tests at most.
+  size_t listRays = std::min(nRays, std::max<size_t>(64, 200000000 / n));
+  report("list", n, 0, trace(world, rays, listRays), listRays);
+  for (bool simd : {false, true}) {
+    std::unique_ptr<SphereSoA<T>> soa;
+    double build = time_build(
+        [&] { soa = std::make_unique<SphereSoA<T>>(world, simd); });
+    report(soa->uses_avx2() ? "soa-avx2" : "soa-scalar", n, build,
+           trace(*soa, rays, listRays), listRays);
+  }
+
+  std::shared_ptr<Hittable<T>> bvh;
+  double build = time_build([&] { bvh = build_bvh(world); });
+  report("bvh", n, build, trace(*bvh, rays, listRays), listRays);
+  report("bvh", n, build, trace(*bvh, rays, nRays), nRays);
+
+  std::unique_ptr<LinearBVH<T>> lbvh;
+  build = time_build([&] { lbvh = std::make_unique<LinearBVH<T>>(world); });
+  report("lbvh", n, build, trace(*lbvh, rays, listRays), listRays);
+  report("lbvh", n, build, trace(*lbvh, rays, nRays), nRays);
+
+  for (bool simd : {false, true}) {
+    std::unique_ptr<BVH4<T>> bvh4;
+    build =
+        time_build([&] { bvh4 = std::make_unique<BVH4<T>>(world, simd); });
+    std::string name = std::string("bvh4-") + wide_kernel_name(bvh4->kernel());
+    report(name.c_str(), n, build, trace(*bvh4, rays, nRays), nRays);
+
+    std::unique_ptr<BVH8<T>> bvh8;
+    build =
+        time_build([&] { bvh8 = std::make_unique<BVH8<T>>(world, simd); });
+    name = std::string("bvh8-") + wide_kernel_name(bvh8->kernel());
+    report(name.c_str(), n, build, trace(*bvh8, rays, nRays), nRays);
+  }
+}
+
+} // namespace
+
+int main(int argc, const char **argv) {
+  cxxopts::Options opts(argv[0], "Acceleration structure benchmark\n");
+  opts.add_options()("h,help", "Print usage")(
+      "sizes", "Comma separated sphere counts",
+      cxxopts::value<std::vector<size_t>>()->default_value(
+          "1000,100000,1000000"))(
+      "rays", "Rays traced per structure",
+      cxxopts::value<size_t>()->default_value("1000000"))(
+      "precision", "Scalar type: double or float",
+      cxxopts::value<std::string>()->default_value("double"));
+  auto result = opts.parse(argc, argv);
+  if (result.count("help")) {
+    std::cout << opts.help() << std::endl;
+    return 0;
+  }
+  auto nRays = result["rays"].as<size_t>();
+  auto precision = result["precision"].as<std::string>();
+  if (precision != "double" && precision != "float") {
+    std::cerr << "Unknown precision '" << precision << "'\n";
+    return 1;
+  }
+
+  std::printf("%-12s %9s %9s %10s %9s %12s\n", "structure", "spheres",
+              "build(s)", "rays", "hits", "Mrays/s");
+  for (size_t n : result["sizes"].as<std::vector<size_t>>()) {
+    if (precision == "float")
+      run<float>(n, nRays);
+    else
+      run<double>(n, nRays);
+  }
+  return 0;
+}
@@ -0,0 +1,263 @@
+// Render throughput of the canonical scenes, and how it scales with
+// threads.
+//
+//   raytracer_bench [--scenes=random,field,glass] [--threads=1,2,4]
+//                   [--width=320] [--spp=8] [--repeat=3]
+//                   [--json=results.json]
+//                   [--baseline=results.json] [--max-regression=10]
+//
+// Every scene is built from a fixed seed and rendered with a fixed sample
+// seed, so each run traces exactly the same rays; the ray counts printed
+// must agree across thread counts, or the exit status is 1. Each
+// configuration is rendered --repeat times and the fastest run is kept.
+//
+// With --baseline, the throughput of every (scene, threads) pair is
+// compared with the same pair in a file written earlier by --json with the
+// same width, spp and precision. The exit status is 1 if any pair lost
+// more than --max-regression percent or has no baseline.
+
+#include "Image.h"
+#include "LinearBVH.h"
+#include "Scenes.h"
+#include "cxxopts.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+
+struct Result {
+  std::string scene;
+  int threads;
+  double seconds;
+  uint64_t rays;
+  double mraysPerSecond() const { return rays / seconds * 1e-6; }
+};
+
+struct Settings {
+  int width;
+  int spp;
+  int repeat;
+  std::string precision;
+};
+
+template <typename T>
+std::vector<Result> run_scene(const std::string &name,
+                              const std::vector<int> &threadCounts,
+                              const Settings &settings) {
+  MaterialTable<T> materials;
+  HittableList<T> world;
+  build_scene(name, materials, world);
+  // Group materials by type, as the renderer does.
+  remap_materials(world, materials.sort_by_type());
+  LinearBVH<T> accel(world);
+  const double aspectRatio = 3. / 2.;
+  auto cam = scene_camera(name, T(aspectRatio));
+
+  std::vector<Result> results;
+  for (int threads : threadCounts) {
+    Result best{name, threads, 0, 0};
+    for (int r = 0; r < settings.repeat; ++r) {
+      Image img{};
+      img.aspectRatio = aspectRatio;
+      img.width = settings.width;
+      img.height = int(settings.width / aspectRatio);
+      img.samplesPerPixel = settings.spp;
+      img.threads = threads;
+      img.sampler = make_sampler("sobol", settings.spp, img.width, img.seed);
+      img.progressStyle = ProgressStyle::Quiet;
+      auto start = std::chrono::steady_clock::now();
+      img.render(cam, accel, materials, 50);
+      std::chrono::duration<double> elapsed =
+          std::chrono::steady_clock::now() - start;
+      if (r == 0 || elapsed.count() < best.seconds)
+        best = {name, threads, elapsed.count(), img.raysTraced};
+    }
+    results.push_back(best);
+  }
+  return results;
+}
+
+void write_json(std::ostream &out, const Settings &settings,
+                const std::vector<Result> &results) {
+  // One result per line, which is what read_baseline expects.
+  out << "{\n  \"width\": " << settings.width << ",\n  \"spp\": "
+      << settings.spp << ",\n  \"precision\": \"" << settings.precision
+      << "\",\n  \"results\": [\n";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const Result &r = results[i];
+    char line[256];
+    std::snprintf(line, sizeof(line),
+                  "    {\"scene\":\"%s\",\"threads\":%d,\"seconds\":%.4f,"
+                  "\"rays\":%llu,\"mrays_per_s\":%.4f}%s\n",
+                  r.scene.c_str(), r.threads, r.seconds,
+                  (unsigned long long)r.rays, r.mraysPerSecond(),
+                  i + 1 < results.size() ? "," : "");
+    out << line;
+  }
+  out << "  ]\n}\n";
+}
+
+/// Mrays/s by (scene, threads) from a file written by write_json, which
+/// must have been run with the same image settings.
+bool read_baseline(const std::string &path, const Settings &settings,
+                   std::map<std::pair<std::string, int>, double> &baseline) {
+  std::ifstream in(path);
+  if (!in) {
+    std::cerr << "Cannot read baseline " << path << '\n';
+    return false;
+  }
+  std::string line;
+  int width = 0, spp = 0;
+  char precision[16] = "unknown"; // files older than the precision field
+  while (std::getline(in, line)) {
+    std::sscanf(line.c_str(), " \"width\": %d", &width);
+    std::sscanf(line.c_str(), " \"spp\": %d", &spp);
+    std::sscanf(line.c_str(), " \"precision\": \"%15[^\"]\"", precision);
+    char scene[64];
+    int threads;
+    double seconds, mrays;
+    unsigned long long rays;
+    auto brace = line.find('{');
+    if (brace != std::string::npos &&
+        std::sscanf(line.c_str() + brace,
+                    "{\"scene\":\"%63[^\"]\",\"threads\":%d,\"seconds\":%lf,"
+                    "\"rays\":%llu,\"mrays_per_s\":%lf",
+                    scene, &threads, &seconds, &rays, &mrays) == 5)
+      baseline[{scene, threads}] = mrays;
+  }
+  if (width != settings.width || spp != settings.spp ||
+      precision != settings.precision) {
+    std::cerr << "Baseline " << path << " was measured at width " << width
+              << ", " << spp << " spp in " << precision << ", not width "
+              << settings.width << ", " << settings.spp << " spp in "
+              << settings.precision << '\n';
+    return false;
+  }
+  return true;
+}
+
+/// 1, 2, 4, ... and the hardware thread count.
+std::vector<int> default_thread_counts() {
+  int n = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<int> counts;
+  for (int t = 1; t < n; t *= 2)
+    counts.push_back(t);
+  counts.push_back(n);
+  return counts;
+}
+
+} // namespace
+
+int main(int argc, const char **argv) {
+  cxxopts::Options opts(argv[0], "Render throughput benchmark\n");
+  opts.add_options()("h,help", "Print usage")(
+      "scenes", "Comma separated scenes (random, field, glass)",
+      cxxopts::value<std::vector<std::string>>()->default_value(
+          "random,field,glass"))(
+      "threads", "Comma separated thread counts (default 1, 2, 4, ... and "
+                 "all hardware threads)",
+      cxxopts::value<std::vector<int>>())(
+      "width", "Image width", cxxopts::value<int>()->default_value("320"))(
+      "spp", "Samples per pixel", cxxopts::value<int>()->default_value("8"))(
+      "repeat", "Renders per configuration; the fastest counts",
+      cxxopts::value<int>()->default_value("3"))(
+      "precision", "Scalar type: double or float",
+      cxxopts::value<std::string>()->default_value("double"))(
+      "json", "Write the results to this file",
+      cxxopts::value<std::string>())(
+      "baseline", "Compare with results written earlier by --json",
+      cxxopts::value<std::string>())(
+      "max-regression", "Fail if Mrays/s drops more than this many percent "
+                        "below the baseline",
+      cxxopts::value<double>()->default_value("10"));
+  auto result = opts.parse(argc, argv);
+  if (result.count("help")) {
+    std::cout << opts.help() << std::endl;
+    return 0;
+  }
+  Settings settings{result["width"].as<int>(), result["spp"].as<int>(),
+                    std::max(1, result["repeat"].as<int>()),
+                    result["precision"].as<std::string>()};
+  if (settings.precision != "double" && settings.precision != "float") {
+    std::cerr << "Unknown precision '" << settings.precision << "'\n";
+    return 1;
+  }
+  auto threadCounts = result.count("threads")
+                          ? result["threads"].as<std::vector<int>>()
+                          : default_thread_counts();
+  auto scenes = result["scenes"].as<std::vector<std::string>>();
+  for (const auto &name : scenes) {
+    const auto &known = scene_names();
+    if (std::find(known.begin(), known.end(), name) == known.end()) {
+      std::cerr << "Unknown scene '" << name << "'\n";
+      return 1;
+    }
+  }
+
+  std::map<std::pair<std::string, int>, double> baseline;
+  const bool compare = result.count("baseline");
+  if (compare && !read_baseline(result["baseline"].as<std::string>(),
+                                settings, baseline))
+    return 1;
+  const double maxRegression = result["max-regression"].as<double>();
+
+  std::printf("%-8s %7s %9s %12s %9s %8s %11s\n", "scene", "threads",
+              "time(s)", "rays", "Mrays/s", "speedup", "vs baseline");
+  std::vector<Result> results;
+  int regressions = 0, missing = 0, mismatches = 0;
+  for (const auto &name : scenes) {
+    auto sceneResults =
+        settings.precision == "float"
+            ? run_scene<float>(name, threadCounts, settings)
+            : run_scene<double>(name, threadCounts, settings);
+    for (const Result &r : sceneResults) {
+      // Speedup over the first (usually single-threaded) configuration.
+      double speedup = sceneResults[0].seconds / r.seconds;
+      std::printf("%-8s %7d %9.3f %12llu %9.3f %7.2fx", r.scene.c_str(),
+                  r.threads, r.seconds, (unsigned long long)r.rays,
+                  r.mraysPerSecond(), speedup);
+      auto base = baseline.find({r.scene, r.threads});
+      if (base != baseline.end()) {
+        double change = 100 * (r.mraysPerSecond() / base->second - 1);
+        bool regressed = change < -maxRegression;
+        regressions += regressed;
+        std::printf(" %+10.1f%%%s", change, regressed ? "  REGRESSION" : "");
+      } else if (compare) {
+        ++missing;
+        std::printf(" %11s", "missing");
+      }
+      // The same rays are traced whatever the thread count.
+      if (r.rays != sceneResults[0].rays) {
+        ++mismatches;
+        std::printf("  RAY COUNT MISMATCH");
+      }
+      std::printf("\n");
+      results.push_back(r);
+    }
+  }
+
+  if (result.count("json")) {
+    std::ofstream out(result["json"].as<std::string>());
+    write_json(out, settings, results);
+  }
+  if (mismatches > 0)
+    std::printf("%d configuration(s) traced a different number of rays "
+                "than with %d thread(s)\n",
+                mismatches, threadCounts[0]);
+  if (missing > 0)
+    std::printf("%d configuration(s) missing from the baseline\n", missing);
+  if (regressions > 0)
+    std::printf("%d configuration(s) more than %g%% slower than the "
+                "baseline\n",
+                regressions, maxRegression);
+  return mismatches > 0 || missing > 0 || regressions > 0 ? 1 : 0;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "RTWeekend.h"
+#include "Ray.h"
+#include "Vec3.h"
+
+#include <algorithm>
+
+/// Axis-aligned bounding box. A default-constructed box is empty, so it can
+/// be grown with expand() without special-casing the first element.
+template <typename T> class AABB {
+public:
+  AABB() : minimum(INF, INF, INF), maximum(-INF, -INF, -INF) {}
+  AABB(const Vec3<T> &a, const Vec3<T> &b) : minimum(a), maximum(b) {}
+
+  Vec3<T> min() const { return minimum; }
+  Vec3<T> max() const { return maximum; }
+
+  /// Slab test against the open interval (tMin, tMax).
+  bool hit(const Ray<T> &r, T tMin, T tMax) const {
+    for (int a = 0; a < 3; ++a) {
+      auto invD = T(1) / r.direction()[a];
+      auto t0 = (minimum[a] - r.origin()[a]) * invD;
+      auto t1 = (maximum[a] - r.origin()[a]) * invD;
+      if (invD < 0)
+        std::swap(t0, t1);
+      tMin = t0 > tMin ? t0 : tMin;
+      tMax = t1 < tMax ? t1 : tMax;
+      if (tMax <= tMin)
+        return false;
+    }
+    return true;
+  }
+
+  void expand(const AABB &b) {
+    for (int a = 0; a < 3; ++a) {
+      minimum[a] = std::min(minimum[a], b.minimum[a]);
+      maximum[a] = std::max(maximum[a], b.maximum[a]);
+    }
+  }
+
+  void expand(const Vec3<T> &p) { expand(AABB(p, p)); }
+
+  Vec3<T> centroid() const { return T(0.5) * (minimum + maximum); }
+
+  T surface_area() const {
+    auto d = maximum - minimum;
+    if (d.x() < 0)
+      return 0;
+    return 2 * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+  }
+
+  /// Index of the axis along which the box is longest.
+  int longest_axis() const {
+    auto d = maximum - minimum;
+    if (d.x() > d.y() && d.x() > d.z())
+      return 0;
+    return d.y() > d.z() ? 1 : 2;
+  }
+
+  Vec3<T> minimum;
+  Vec3<T> maximum;
+};
+
+template <typename T>
+inline AABB<T> surrounding_box(const AABB<T> &a, const AABB<T> &b) {
+  AABB<T> box = a;
+  box.expand(b);
+  return box;
+}
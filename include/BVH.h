@@ -0,0 +1,198 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "AABB.h"
+#include "Hittable.h"
+#include "HittableList.h"
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+/// A primitive as seen by the BVH builders: the object with its bounds
+/// cached, so building never calls bounding_box() more than once.
+template <typename T> struct BVHPrimitive {
+  std::shared_ptr<Hittable<T>> object;
+  AABB<T> box;
+  Vec3<T> centroid;
+};
+
+template <typename T>
+std::vector<BVHPrimitive<T>> make_bvh_primitives(const HittableList<T> &list);
+
+/// Partition prims[begin, end) with a binned surface area heuristic and
+/// return the split point. Returns begin when keeping the range as a single
+/// leaf is cheaper than any split; never returns end.
+template <typename T>
+size_t sah_partition(std::vector<BVHPrimitive<T>> &prims, size_t begin,
+                     size_t end, size_t maxLeafSize = 1);
+
+/// Binary bounding volume hierarchy node.
+template <typename T> class BVHNode : public Hittable<T> {
+public:
+  BVHNode(std::shared_ptr<Hittable<T>> l, std::shared_ptr<Hittable<T>> r,
+          const AABB<T> &b)
+      : left(l), right(r), box(b) {}
+
+  virtual bool hit(const Ray<T> &r, T tMin, T tMax,
+                   HitRecord<T> &rec) const override;
+
+  virtual bool bounding_box(AABB<T> &outputBox) const override {
+    outputBox = box;
+    return true;
+  }
+
+  std::shared_ptr<Hittable<T>> left;
+  std::shared_ptr<Hittable<T>> right;
+  AABB<T> box;
+};
+
+/// Build a BVH over every object in list. Secondary rays then pay roughly
+/// O(log n) box tests instead of one test per object.
+template <typename T>
+std::shared_ptr<Hittable<T>> build_bvh(const HittableList<T> &list);
+
+template <typename T>
+inline bool BVHNode<T>::hit(const Ray<T> &r, T tMin, T tMax,
+                            HitRecord<T> &rec) const {
+  count_ray_stat(&RayStats::nodeVisits);
+  if (!box.hit(r, tMin, tMax))
+    return false;
+
+  bool hitLeft = left->hit(r, tMin, tMax, rec);
+  bool hitRight = right->hit(r, tMin, hitLeft ? rec.t : tMax, rec);
+  return hitLeft || hitRight;
+}
+
+template <typename T>
+inline std::vector<BVHPrimitive<T>>
+make_bvh_primitives(const HittableList<T> &list) {
+  std::vector<BVHPrimitive<T>> prims;
+  prims.reserve(list.objects.size());
+  for (const auto &obj : list.objects) {
+    AABB<T> box;
+    if (!obj->bounding_box(box))
+      throw std::invalid_argument("BVH: object without a bounding box");
+    prims.push_back({obj, box, box.centroid()});
+  }
+  return prims;
+}
+
+template <typename T>
+inline size_t sah_partition(std::vector<BVHPrimitive<T>> &prims, size_t begin,
+                            size_t end, size_t maxLeafSize) {
+  constexpr int nBins = 16;
+  // Cost of one box test relative to one primitive test.
+  constexpr double traversalCost = 0.5;
+
+  size_t n = end - begin;
+  AABB<T> bounds, centroidBounds;
+  for (size_t i = begin; i < end; ++i) {
+    bounds.expand(prims[i].box);
+    centroidBounds.expand(prims[i].centroid);
+  }
+
+  int bestAxis = -1, bestBin = 0;
+  double bestCost = INF;
+  for (int axis = 0; axis < 3; ++axis) {
+    double lo = centroidBounds.minimum[axis];
+    double extent = centroidBounds.maximum[axis] - lo;
+    if (extent <= 0)
+      continue;
+
+    size_t counts[nBins] = {};
+    AABB<T> boxes[nBins];
+    for (size_t i = begin; i < end; ++i) {
+      int b = std::min(
+          nBins - 1, int(nBins * (prims[i].centroid[axis] - lo) / extent));
+      counts[b]++;
+      boxes[b].expand(prims[i].box);
+    }
+
+    // Sweep from the right to get the suffix areas, then from the left.
+    double rightArea[nBins];
+    size_t rightCount[nBins];
+    AABB<T> acc;
+    size_t cnt = 0;
+    for (int b = nBins - 1; b > 0; --b) {
+      acc.expand(boxes[b]);
+      cnt += counts[b];
+      rightArea[b] = acc.surface_area();
+      rightCount[b] = cnt;
+    }
+    acc = AABB<T>();
+    cnt = 0;
+    for (int b = 1; b < nBins; ++b) {
+      acc.expand(boxes[b - 1]);
+      cnt += counts[b - 1];
+      double cost = acc.surface_area() * cnt + rightArea[b] * rightCount[b];
+      if (cnt && rightCount[b] && cost < bestCost) {
+        bestCost = cost;
+        bestAxis = axis;
+        bestBin = b;
+      }
+    }
+  }
+
+  double area = bounds.surface_area();
+  if (bestAxis >= 0 && n <= maxLeafSize &&
+      traversalCost + bestCost / area >= double(n))
+    return begin;
+
+  if (bestAxis < 0) {
+    // Every centroid coincides: split by count.
+    if (n <= maxLeafSize)
+      return begin;
+    return begin + n / 2;
+  }
+
+  double lo = centroidBounds.minimum[bestAxis];
+  double extent = centroidBounds.maximum[bestAxis] - lo;
+  auto mid = std::partition(
+      prims.begin() + begin, prims.begin() + end,
+      [&](const BVHPrimitive<T> &p) {
+        return std::min(nBins - 1,
+                        int(nBins * (p.centroid[bestAxis] - lo) / extent)) <
+               bestBin;
+      });
+  if (mid == prims.begin() + begin || mid == prims.begin() + end) {
+    // Rounding put everything in one bin; fall back to a median split.
+    mid = prims.begin() + begin + n / 2;
+    std::nth_element(prims.begin() + begin, mid, prims.begin() + end,
+                     [&](const BVHPrimitive<T> &a, const BVHPrimitive<T> &b) {
+                       return a.centroid[bestAxis] < b.centroid[bestAxis];
+                     });
+  }
+  return mid - prims.begin();
+}
+
+namespace detail {
+
+template <typename T>
+inline std::shared_ptr<Hittable<T>>
+build_bvh_node(std::vector<BVHPrimitive<T>> &prims, size_t begin, size_t end) {
+  if (end - begin == 1)
+    return prims[begin].object;
+
+  size_t mid = sah_partition(prims, begin, end);
+  auto left = build_bvh_node(prims, begin, mid);
+  auto right = build_bvh_node(prims, mid, end);
+
+  AABB<T> box;
+  for (size_t i = begin; i < end; ++i)
+    box.expand(prims[i].box);
+  return std::make_shared<BVHNode<T>>(left, right, box);
+}
+
+} // namespace detail
+
+template <typename T>
+inline std::shared_ptr<Hittable<T>> build_bvh(const HittableList<T> &list) {
+  if (list.objects.empty())
+    return std::make_shared<HittableList<T>>();
+  auto prims = make_bvh_primitives(list);
+  return detail::build_bvh_node(prims, 0, prims.size());
+}
+
+#endif /* BVH_H */
@@ -3,18 +3,17 @@
 
 #include "RTWeekend.h"
 #include "Ray.h"
+#include "Sampler.h"
 #include "Vec3.h"
 
-class Camera {
+template <typename T> class Camera {
 public:
-  Camera(Point3 lookFrom, Point3 lookAt, Vec3<double> vup, double vfov,
-         double aspectRatio, double aperture, double focusDist) {
+  Camera(Vec3<T> lookFrom, Vec3<T> lookAt, Vec3<T> vup, T vfov, T aspectRatio,
+         T aperture, T focusDist) {
     auto theta = degrees_to_radians(vfov);
     auto h = tan(theta / 2.0);
-    auto viewportHeight = 2.0 * h;
-    auto viewportWidth = aspectRatio * viewportHeight;
-
-    auto focalLength = 1.0;
+    T viewportHeight = 2.0 * h;
+    T viewportWidth = aspectRatio * viewportHeight;
 
     w = unit_vector(lookFrom - lookAt);
     u = unit_vector(cross(vup, w));
@@ -23,24 +22,29 @@ public:
     origin = lookFrom;
     horizontal = focusDist * viewportWidth * u;
     vertical = focusDist * viewportHeight * v;
-    lowerLeftCorner = origin - horizontal / 2. - vertical / 2. - focusDist * w;
-    lensRadius = aperture / 2.;
+    lowerLeftCorner = origin - horizontal / T(2) - vertical / T(2) -
+                      focusDist * w;
+    lensRadius = aperture / 2;
   }
 
-  Ray<double> getRay(double s, double t) const {
-    auto rd = lensRadius * random_in_unit_disk<double>();
+  /// The ray through viewport point (s, t), leaving from the lens point of
+  /// the current path's LensDim sample.
+  Ray<T> getRay(T s, T t) const {
+    T lu, lv;
+    sample_2d(LensDim, lu, lv);
+    auto rd = lensRadius * disk_from_square(lu, lv);
     auto offset = u * rd.x() + v * rd.y();
-    return Ray(origin + offset, lowerLeftCorner + s * horizontal +
-                                    t * vertical - origin - offset);
+    return Ray<T>(origin + offset, lowerLeftCorner + s * horizontal +
+                                       t * vertical - origin - offset);
   }
 
 private:
-  Point3 origin;
-  Point3 lowerLeftCorner;
-  Vec3<double> horizontal;
-  Vec3<double> vertical;
-  Vec3<double> u, v, w;
-  double lensRadius;
+  Vec3<T> origin;
+  Vec3<T> lowerLeftCorner;
+  Vec3<T> horizontal;
+  Vec3<T> vertical;
+  Vec3<T> u, v, w;
+  T lensRadius;
 };
 
-#endif /* CAMERA_H */
\ No newline at end of file
+#endif /* CAMERA_H */
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "Image.h"
+#include "TileScheduler.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// The part of an Image that a checkpoint stores.
+struct RenderState {
+  int pass = 0;
+  std::vector<Color> data;
+  std::vector<int> sampleCount;
+  std::vector<int> sampleTarget;
+  std::vector<PixelVariance> variance;
+};
+
+/// Periodic snapshots of a render in progress, written by a background
+/// thread so the render threads never wait for the disk.
+///
+/// A checkpoint holds the accumulation state of every pixel (sum, sample
+/// count, sample target and, when sampling adaptively, the variance
+/// estimate) plus the pass number. The random streams need no state of
+/// their own: they are keyed by (seed, pixel, sample), so a pixel's count
+/// says exactly where its streams continue. Pixels are independent, so a
+/// checkpoint taken mid-pass, with some tiles ahead of others, still
+/// resumes to the same image as an uninterrupted render.
+///
+/// The file is raw native-endian binary: the magic "FRTCKPT1", width,
+/// height, pass, a variance flag, the settings string (options that must
+/// match on resume), then the per-pixel arrays. Each write goes to
+/// "<path>.tmp" and is renamed over path, so a crash mid-write leaves the
+/// previous checkpoint intact.
+class CheckpointWriter {
+public:
+  /// Start writing img's state to path every interval seconds.
+  CheckpointWriter(const Image &img, std::string path, double interval);
+  /// Stop the writer thread (after a write in progress, if any).
+  ~CheckpointWriter();
+  CheckpointWriter(const CheckpointWriter &) = delete;
+  CheckpointWriter &operator=(const CheckpointWriter &) = delete;
+
+  /// Record the sample targets of a new pass. Call between passes; waits
+  /// for a checkpoint being written to finish.
+  void start_pass(const Image &img, int pass);
+  /// Record the pixels of a tile that has finished its pass. Only the
+  /// calling thread touches those pixels then, so they can be copied
+  /// while other tiles are still rendering.
+  void tile_done(const Image &img, const Tile &tile);
+
+private:
+  void run();
+  void write();
+
+  std::string path;
+  double interval;
+  int width, height;
+  std::string settings;
+  std::mutex passMutex; // held by a write, so no pass starts meanwhile
+  std::mutex mutex;     // guards snapshot and stop
+  std::condition_variable wake;
+  bool stop = false;
+  RenderState snapshot; // each pixel as of its last finished tile
+  std::thread thread;
+};
+
+/// Load the checkpoint at path into img: buffers, pass and sample targets.
+/// Returns false, with a message on stderr, if the file cannot be read or
+/// was written for a different size or settings.
+bool load_checkpoint(const std::string &path, Image &img);
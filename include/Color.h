@@ -5,6 +5,11 @@
 #include "Vec3.h"
 #include <iostream>
 
+/// Rec. 709 luminance of a linear color.
+inline double luminance(const Color &c) {
+  return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+}
+
 inline void write_color(std::ostream &out, Color pixel_color,
                         int samples_per_pixel) {
   auto r = pixel_color.x();
@@ -1,28 +1,75 @@
 #ifndef HITTABLE_H
 #define HITTABLE_H
 
+#include "AABB.h"
 #include "RTWeekend.h"
 #include "Ray.h"
+#include "RayPacket.h"
+#include "RayStats.h"
 
-class Material;
-struct HitRecord {
-  Point3 p;
-  Vec3<double> normal;
-  std::shared_ptr<Material> matPtr;
-  double t;
+#include <cstdint>
+
+template <typename T> struct HitRecord {
+  Vec3<T> p;
+  Vec3<T> normal;
+  uint32_t matId; // index into the scene's MaterialTable
+  T t;
+  T error; // bound on the absolute rounding error in each component of p
   bool frontFace;
 
-  inline void set_face_normal(const Ray<double> &r,
-                              const Vec3<double> &outwardNormal) {
+  inline void set_face_normal(const Ray<T> &r, const Vec3<T> &outwardNormal) {
     frontFace = dot(r.direction(), outwardNormal) < 0;
     normal = frontFace ? outwardNormal : -outwardNormal;
   }
 };
 
-class Hittable {
+/// Start a ray at a hit point, leaving the surface in direction w. The
+/// origin is pushed off the surface by the hit's error bound along the
+/// normal and then rounded away from it, so the new ray cannot hit the
+/// surface it starts on. This scales with the precision in use, which a
+/// fixed tMin (0.001 used to be passed to hit()) cannot do.
+template <typename T>
+inline Ray<T> spawn_ray(const HitRecord<T> &rec, const Vec3<T> &w) {
+  const auto &n = rec.normal;
+  T d = (std::fabs(n.x()) + std::fabs(n.y()) + std::fabs(n.z())) * rec.error;
+  Vec3<T> offset = d * n;
+  if (dot(w, n) < 0)
+    offset = -offset;
+  Vec3<T> origin = rec.p + offset;
+  for (int i = 0; i < 3; ++i) {
+    if (offset[i] > 0)
+      origin[i] = std::nextafter(origin[i], std::numeric_limits<T>::max());
+    else if (offset[i] < 0)
+      origin[i] = std::nextafter(origin[i], std::numeric_limits<T>::lowest());
+  }
+  return Ray<T>(origin, w);
+}
+
+template <typename T> class Hittable {
 public:
-  virtual bool hit(const Ray<double> &r, double tMin, double tMax,
-                   HitRecord &rec) const = 0;
+  virtual ~Hittable() = default;
+
+  virtual bool hit(const Ray<T> &r, T tMin, T tMax,
+                   HitRecord<T> &rec) const = 0;
+
+  /// Intersect the lanes of packet selected by mask over (0, tMax[lane]),
+  /// shrinking tMax and filling recs[lane] for every lane that hits. Returns
+  /// the mask of those lanes. The default traces each lane as a single ray.
+  virtual uint32_t hit_packet(RayPacket<T> &packet, uint32_t mask,
+                              HitRecord<T> *recs) const {
+    uint32_t hits = 0;
+    for (int l = 0; l < RayPacket<T>::size; ++l) {
+      if ((mask >> l & 1) &&
+          hit(packet.ray(l), 0, packet.tMax[l], recs[l])) {
+        packet.tMax[l] = recs[l].t;
+        hits |= 1u << l;
+      }
+    }
+    return hits;
+  }
+
+  /// Compute a box enclosing the object, returning false if it is unbounded.
+  virtual bool bounding_box(AABB<T> &outputBox) const = 0;
 };
 
-#endif
\ No newline at end of file
+#endif
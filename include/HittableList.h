@@ -6,27 +6,34 @@
 #include <memory>
 #include <vector>
 
-class HittableList : public Hittable {
+template <typename T> class HittableList : public Hittable<T> {
 public:
   HittableList() {}
-  HittableList(std::shared_ptr<Hittable> object) { add(object); }
+  HittableList(std::shared_ptr<Hittable<T>> object) { add(object); }
 
   void clear() { objects.clear(); }
 
-  void add(std::shared_ptr<Hittable> object) { objects.push_back(object); }
+  void add(std::shared_ptr<Hittable<T>> object) { objects.push_back(object); }
 
-  virtual bool hit(const Ray<double> &r, double tMin, double tMax,
-                   HitRecord &rec) const override;
+  virtual bool hit(const Ray<T> &r, T tMin, T tMax,
+                   HitRecord<T> &rec) const override;
+
+  virtual uint32_t hit_packet(RayPacket<T> &packet, uint32_t mask,
+                              HitRecord<T> *recs) const override;
+
+  virtual bool bounding_box(AABB<T> &outputBox) const override;
 
 public:
-  std::vector<std::shared_ptr<Hittable>> objects;
+  std::vector<std::shared_ptr<Hittable<T>>> objects;
 };
 
-inline bool HittableList::hit(const Ray<double> &r, double tMin, double tMax,
-                              HitRecord &rec) const {
-  HitRecord tmpRec;
+template <typename T>
+inline bool HittableList<T>::hit(const Ray<T> &r, T tMin, T tMax,
+                                 HitRecord<T> &rec) const {
+  HitRecord<T> tmpRec;
   bool hitAnything = false;
   auto closestSoFar = tMax;
+  count_ray_stat(&RayStats::listVisits, objects.size());
   for (const auto &obj : objects) {
     if (obj->hit(r, tMin, closestSoFar, tmpRec)) {
       hitAnything = true;
@@ -37,4 +44,30 @@ inline bool HittableList::hit(const Ray<double> &r, double tMin, double tMax,
   return hitAnything;
 }
 
-#endif /* HITTABLE_LIST_H */
\ No newline at end of file
+template <typename T>
+inline uint32_t HittableList<T>::hit_packet(RayPacket<T> &packet,
+                                            uint32_t mask,
+                                            HitRecord<T> *recs) const {
+  uint32_t hits = 0;
+  count_ray_stat(&RayStats::listVisits, objects.size());
+  for (const auto &obj : objects)
+    hits |= obj->hit_packet(packet, mask, recs);
+  return hits;
+}
+
+template <typename T>
+inline bool HittableList<T>::bounding_box(AABB<T> &outputBox) const {
+  if (objects.empty())
+    return false;
+
+  AABB<T> box;
+  outputBox = AABB<T>();
+  for (const auto &obj : objects) {
+    if (!obj->bounding_box(box))
+      return false;
+    outputBox.expand(box);
+  }
+  return true;
+}
+
+#endif /* HITTABLE_LIST_H */
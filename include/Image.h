@@ -3,25 +3,207 @@
 #include "Camera.h"
 #include "Color.h"
 #include "HittableList.h"
+#include "Material.h"
+#include "Progress.h"
 #include "Ray.h"
+#include "Sampler.h"
+#include "TileScheduler.h"
+#include <algorithm>
+#include <cmath>
 #include <fstream>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
 #include <vector>
 
+/// Sky gradient returned for rays that escape the scene.
+template <typename T> inline Vec3<T> background(const Ray<T> &r) {
+  Vec3<T> unit_direction = unit_vector(r.direction());
+  T t = 0.5 * (unit_direction.y() + 1);
+  return (1 - t) * Vec3<T>(1, 1, 1) + t * Vec3<T>(0.5, 0.7, 1.0);
+}
+
+/// Counters of the wavefront renderer for the bounces after the camera
+/// rays, summed over tiles and printed by print_wavefront_stats.
+struct WavefrontStats {
+  uint64_t rays = 0;            // secondary rays intersected
+  uint64_t packets = 0;         // packets they were traced in
+  uint64_t coherentPackets = 0; // packets whose rays share an octant
+  double intersectSeconds = 0;  // time in the secondary intersect stages
+  double sortSeconds = 0;       // time spent sorting the queues
+  uint64_t cacheMisses = 0;     // during intersection, if countable
+  bool cacheMissesCounted = false;
+
+  WavefrontStats &operator+=(const WavefrontStats &o) {
+    rays += o.rays;
+    packets += o.packets;
+    coherentPackets += o.coherentPackets;
+    intersectSeconds += o.intersectSeconds;
+    sortSeconds += o.sortSeconds;
+    cacheMisses += o.cacheMisses;
+    cacheMissesCounted = cacheMissesCounted || o.cacheMissesCounted;
+    return *this;
+  }
+};
+
+/// Running mean and variance of one pixel's sample luminance (Welford).
+struct PixelVariance {
+  int n = 0;
+  double mean = 0;
+  double m2 = 0;
+
+  void add(double x) {
+    ++n;
+    double delta = x - mean;
+    mean += delta / n;
+    m2 += delta * (x - mean);
+  }
+
+  /// Standard error of the pixel's displayed value. The output is gamma 2,
+  /// i.e. sqrt(mean), whose error is about stderr / (2 sqrt(mean)), so the
+  /// threshold is in the same [0,1] units as the written image.
+  double display_error() const {
+    if (n < 2)
+      return INF;
+    double stdErr = std::sqrt(m2 / (n - 1) / n);
+    return stdErr / (2 * std::sqrt(std::max(mean, 1e-4)));
+  }
+};
+
+class StreamingOutput;
+
 struct Image {
 public:
   void printInfo();
-  void render(Camera &cam, HittableList &world, int maxDepth);
+  /// Render in single or double precision; instantiated for float and
+  /// double in Image.cc. The accumulated data is always double.
+  ///
+  /// With stream set, the buffers hold one band of rows at a time (see
+  /// band_rows), and each band is written out once it is finished; the
+  /// buffers then hold only the last band.
+  template <typename T>
+  void render(const Camera<T> &cam, const Hittable<T> &world,
+              const MaterialTable<T> &materials, int maxDepth);
 
 private:
-  Color ray_color(const Ray<double> &r, const Hittable &world, int depth);
+  template <typename T>
+  void render_tile(const Tile &tile, const Camera<T> &cam,
+                   const Hittable<T> &world, const MaterialTable<T> &materials,
+                   int maxDepth);
+  template <typename T>
+  void render_tile_packets(const Tile &tile, const Camera<T> &cam,
+                           const Hittable<T> &world,
+                           const MaterialTable<T> &materials, int maxDepth);
+  /// Breadth-first variant of render_tile, defined in Wavefront.cc.
+  template <typename T>
+  void render_tile_wavefront(const Tile &tile, const Camera<T> &cam,
+                             const Hittable<T> &world,
+                             const MaterialTable<T> &materials, int maxDepth,
+                             WavefrontStats &stats);
+  template <typename T>
+  Vec3<T> ray_color(const Ray<T> &r, const Hittable<T> &world,
+                    const MaterialTable<T> &materials, int maxDepth);
+  /// Radiance along r given its first intersection (hit, hitRec), which
+  /// may have come from a packet trace.
+  template <typename T>
+  Vec3<T> trace_path(const Ray<T> &r, bool hit, const HitRecord<T> &hitRec,
+                     const Hittable<T> &world,
+                     const MaterialTable<T> &materials, int maxDepth);
+
+  /// Accumulate one sample into pixel p. Samples of a pixel always arrive
+  /// in sample order, so the sums do not depend on how they were batched.
+  void add_sample(int p, const Color &c) {
+    p = slot(p);
+    ++thread_work().samples;
+    data[p] += c;
+    ++sampleCount[p];
+    if (!variance.empty())
+      variance[p].add(luminance(c));
+  }
+
+  /// Render rows [y0, y1), the band the buffers currently hold, to
+  /// completion: every pass, and streaming the rows out if stream is set.
+  template <typename T>
+  void render_band(int y0, int y1, const Camera<T> &cam,
+                   const Hittable<T> &world, const MaterialTable<T> &materials,
+                   int maxDepth, Progress &progress, SchedulerStats &stats,
+                   WavefrontStats &waveStats);
+
+  /// Rows per band of a streaming render: as many whole tile rows as fit
+  /// in streamMemory, but at least one.
+  int band_rows() const;
+
+  /// Raise sampleTarget by adaptiveBatch for every pixel that is not yet
+  /// converged; returns false when none is left.
+  bool plan_adaptive_pass();
+
+  /// Raise sampleTarget by one for every pixel below sampleCap, or below
+  /// samplesPerPixel without a time budget (a one-pass render, or one
+  /// resumed from a budgeted render's checkpoint); returns false when none
+  /// is left.
+  bool plan_progressive_pass();
+
+  /// Russian roulette after a bounce: past rrMinDepth, continue with a
+  /// probability equal to the path's remaining throughput and reweight the
+  /// survivors, which keeps the estimate unbiased while dark paths end
+  /// early. Returns false if the path ends.
+  template <typename T>
+  bool survive_roulette(Vec3<T> &throughput, int bounce) const {
+    if (bounce + 1 < rrMinDepth)
+      return true;
+    auto maxComponent =
+        std::max({throughput.x(), throughput.y(), throughput.z()});
+    auto p = clamp(maxComponent, T(0.05), T(1));
+    if (random_t<T>() >= p)
+      return false;
+    throughput /= p;
+    return true;
+  }
 
 public:
+  /// Index in data, sampleCount, sampleTarget and variance of pixel
+  /// p = i + j * width; the buffers start at row firstRow.
+  int slot(int p) const { return p - firstRow * width; }
+
   double aspectRatio;
   int width;
   int height;
-  int samplesPerPixel;
+  int samplesPerPixel; // samples per pixel of a one-pass render
   std::vector<Color> data; // [r0,g0,b0,r1,g1,b1, ..., r(n-1),g(n-1),b(n-1)]
+  std::vector<int> sampleCount;  // samples summed into each pixel of data
+  std::vector<int> sampleTarget; // samples each pixel has after this pass
+  std::vector<PixelVariance> variance; // per pixel, adaptive sampling only
+  int threads = 0;   // worker threads, 0 = all hardware threads
+  int tileSize = 16; // 16x16 tiles of Color fit comfortably in L1
+  uint64_t seed = 0; // base seed of the per-path random streams
+  int rrMinDepth = 3; // bounces before Russian roulette may end a path
+  bool packets = true; // trace camera rays in RayPacket-sized packets
+  bool wavefront = false; // trace tiles breadth first (Wavefront.cc)
+  bool sortRays = false;  // wavefront only: sort secondary rays by key
+  double noiseThreshold = 0; // adaptive sampling target, 0 = off
+  int minSamples = 16;       // adaptive: samples of the first pass
+  static constexpr int adaptiveBatch = 8; // adaptive: samples per pass
+  double timeBudget = 0; // seconds for 1 spp passes, 0 = no deadline
+  static constexpr int noSampleCap = std::numeric_limits<int>::max();
+  int sampleCap = noSampleCap; // adaptive or progressive: spp at most
+  int pass = 0;          // current render pass
+  bool resumed = false;  // buffers and pass were loaded from a checkpoint
+  std::string checkpointFile;     // write checkpoints here, empty = off
+  double checkpointInterval = 60; // seconds between checkpoints
+  std::string renderSettings; // options a resumed render must share
+  int firstRow = 0; // first row held in the buffers (streaming renders)
+  StreamingOutput *stream = nullptr; // write rows as they finish, or null
+  size_t streamMemory = size_t(256) << 20; // streaming: buffer bytes cap
+  ProgressStyle progressStyle = ProgressStyle::Text;
+  uint64_t raysTraced = 0; // by the last render, for throughput figures
+  SchedulerStats schedulerStats; // load balance of the last render
+  std::unique_ptr<Sampler> sampler; // pixel, lens and scatter samples
 };
 
 std::ostream &operator<<(std::ostream &out, const Image &img);
+/// Write the samples taken per pixel as a grayscale P3 image, white being
+/// the most samples any pixel took.
+void write_sample_map(std::ostream &out, const Image &img);
+void print_scheduler_stats(const SchedulerStats &stats);
+void print_wavefront_stats(const WavefrontStats &stats, bool sorted);
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "Image.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+
+/// Encodes a finished Image into one file format. Every writer divides
+/// each pixel by its own sample count, so adaptive and progressive renders
+/// come out at the right brightness.
+class ImageWriter {
+public:
+  virtual ~ImageWriter() = default;
+  virtual void write(std::ostream &out, const Image &img) const = 0;
+};
+
+/// ASCII P3, one pixel per line (operator<<).
+class P3Writer : public ImageWriter {
+public:
+  void write(std::ostream &out, const Image &img) const override;
+};
+
+/// A format whose rows all take the same number of bytes, so any band
+/// of rows can be encoded on its own and put at its offset in the file.
+class RowWriter : public ImageWriter {
+public:
+  void write(std::ostream &out, const Image &img) const override;
+
+  virtual std::string header(int width, int height) const = 0;
+  virtual size_t row_bytes(int width) const = 0;
+  /// Whether the file stores the bottom row (j = 0) first.
+  virtual bool bottom_up() const = 0;
+  /// Encode row j of img into row_bytes(img.width) bytes at out.
+  virtual void encode_row(const Image &img, int j, char *out) const = 0;
+};
+
+/// Binary P6: the same 8-bit values as P3 at a fraction of the size.
+class P6Writer : public RowWriter {
+public:
+  std::string header(int width, int height) const override;
+  size_t row_bytes(int width) const override { return 3 * size_t(width); }
+  bool bottom_up() const override { return false; }
+  void encode_row(const Image &img, int j, char *out) const override;
+};
+
+/// 8-bit RGB PNG, deflated in-process (LZ77 with dynamic Huffman codes)
+/// after choosing the best of the five PNG row filters for each row.
+class PngWriter : public ImageWriter {
+public:
+  void write(std::ostream &out, const Image &img) const override;
+};
+
+/// Little-endian 32-bit float PFM of the linear (not gamma corrected)
+/// radiance, for HDR post-processing.
+class PfmWriter : public RowWriter {
+public:
+  std::string header(int width, int height) const override;
+  size_t row_bytes(int width) const override {
+    return 3 * sizeof(float) * size_t(width);
+  }
+  bool bottom_up() const override { return true; }
+  void encode_row(const Image &img, int j, char *out) const override;
+};
+
+/// Writes rows of a RowWriter format into a file while the image is still
+/// being rendered, each band with one pwrite at its final offset, so the
+/// file is complete when the render ends and finished rows need not be
+/// kept in memory.
+class StreamingOutput {
+public:
+  /// Create path, sized for the whole image, and write the header. Check
+  /// ok() for errors.
+  StreamingOutput(const RowWriter &format, const std::string &path,
+                  int width, int height);
+  ~StreamingOutput();
+  StreamingOutput(const StreamingOutput &) = delete;
+  StreamingOutput &operator=(const StreamingOutput &) = delete;
+
+  bool ok() const { return fd >= 0 && !failed; }
+  /// Encode and write rows [y0, y1) of img, which must be in its buffers.
+  /// Threads may write disjoint rows concurrently.
+  void write_rows(const Image &img, int y0, int y1);
+
+private:
+  void write_at(const std::string &bytes, size_t offset);
+
+  const RowWriter &format;
+  int fd = -1;
+  int height;
+  size_t headerBytes, rowBytes;
+  std::atomic<bool> failed{false};
+};
+
+/// Create the writer for format (p3|p6|png|pfm), or for the extension of
+/// path (.ppm is P6) if format is "auto". Returns nullptr if there is no
+/// such format.
+std::unique_ptr<ImageWriter> make_image_writer(const std::string &format,
+                                               const std::string &path);
+
+/// Gamma-2 quantize row j of img (j = 0 is the bottom row, which must be
+/// in its buffers) to 8-bit RGB, writing 3 * img.width bytes to out. Uses
+/// AVX2 where available, with the same result as the scalar path.
+void quantize_row(const Image &img, int j, uint8_t *out);
@@ -0,0 +1,260 @@
+#ifndef LINEAR_BVH_H
+#define LINEAR_BVH_H
+
+#include "BVH.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/// One node of a LinearBVH. Nodes are stored in depth-first order, so the
+/// first child of an interior node always directly follows it and only the
+/// second child needs an offset. Bounds are floats rounded outwards, which
+/// keeps the node at 32 bytes: two nodes per cache line.
+struct alignas(32) LinearBVHNode {
+  float bounds[2][3];
+  union {
+    uint32_t primitivesOffset;  // leaf
+    uint32_t secondChildOffset; // interior
+  };
+  uint16_t nPrimitives; // 0 for interior nodes
+  uint8_t axis;         // split axis of interior nodes
+  uint8_t pad;
+};
+static_assert(sizeof(LinearBVHNode) == 32, "LinearBVHNode must be 32 bytes");
+
+/// A BVH flattened into one contiguous array of 32-byte nodes with the
+/// primitives in leaf order, traversed with a small explicit stack. At each
+/// interior node the child nearer along the split axis is visited first, so
+/// closestSoFar shrinks early and more far boxes are culled.
+///
+/// Traversal pushes one entry per interior node on the way down, so the
+/// tree may be at most stackSize levels deep; the constructor throws
+/// std::length_error for deeper trees (heavily clustered input).
+template <typename T> class LinearBVH : public Hittable<T> {
+public:
+  static constexpr size_t maxLeafSize = 4;
+  static constexpr int stackSize = 64;
+
+  LinearBVH(const HittableList<T> &list);
+
+  virtual bool hit(const Ray<T> &r, T tMin, T tMax,
+                   HitRecord<T> &rec) const override;
+
+  virtual uint32_t hit_packet(RayPacket<T> &packet, uint32_t mask,
+                              HitRecord<T> *recs) const override;
+
+  virtual bool bounding_box(AABB<T> &outputBox) const override {
+    if (nodes.empty())
+      return false;
+    outputBox = AABB<T>(
+        Vec3<T>(nodes[0].bounds[0][0], nodes[0].bounds[0][1],
+                nodes[0].bounds[0][2]),
+        Vec3<T>(nodes[0].bounds[1][0], nodes[0].bounds[1][1],
+                nodes[0].bounds[1][2]));
+    return true;
+  }
+
+  std::vector<LinearBVHNode> nodes;
+  std::vector<const Hittable<T> *> primitives;
+  int depth = 0; // levels below the root
+
+private:
+  uint32_t flatten(std::vector<BVHPrimitive<T>> &prims, size_t begin,
+                   size_t end, int level);
+
+  // Keeps the primitives alive; traversal only touches the raw pointers.
+  std::vector<std::shared_ptr<Hittable<T>>> owned;
+};
+
+template <typename T>
+inline LinearBVH<T>::LinearBVH(const HittableList<T> &list) {
+  auto prims = make_bvh_primitives(list);
+  if (prims.empty())
+    return;
+  nodes.reserve(2 * prims.size());
+  flatten(prims, 0, prims.size(), 0);
+  if (depth > stackSize)
+    throw std::length_error("LinearBVH: " + std::to_string(depth) +
+                            " levels exceed the traversal stack");
+  for (const auto &p : prims)
+    owned.push_back(p.object);
+}
+
+template <typename T>
+inline uint32_t LinearBVH<T>::flatten(std::vector<BVHPrimitive<T>> &prims,
+                                      size_t begin, size_t end, int level) {
+  depth = std::max(depth, level);
+  AABB<T> box;
+  for (size_t i = begin; i < end; ++i)
+    box.expand(prims[i].box);
+
+  uint32_t index = nodes.size();
+  nodes.emplace_back();
+  for (int a = 0; a < 3; ++a) {
+    nodes[index].bounds[0][a] =
+        std::nextafter(float(box.minimum[a]), -INFINITY);
+    nodes[index].bounds[1][a] =
+        std::nextafter(float(box.maximum[a]), INFINITY);
+  }
+
+  size_t mid = end - begin == 1 ? begin
+                                : sah_partition(prims, begin, end, maxLeafSize);
+  if (mid == begin) {
+    nodes[index].primitivesOffset = primitives.size();
+    nodes[index].nPrimitives = end - begin;
+    for (size_t i = begin; i < end; ++i)
+      primitives.push_back(prims[i].object.get());
+    return index;
+  }
+
+  // Pick the axis along which the children are separated the most.
+  AABB<T> leftBox, rightBox;
+  for (size_t i = begin; i < mid; ++i)
+    leftBox.expand(prims[i].centroid);
+  for (size_t i = mid; i < end; ++i)
+    rightBox.expand(prims[i].centroid);
+  auto gap = rightBox.centroid() - leftBox.centroid();
+  int axis = 0;
+  for (int a = 1; a < 3; ++a)
+    if (std::fabs(gap[a]) > std::fabs(gap[axis]))
+      axis = a;
+  // Make the first child the one with the smaller centroids along axis.
+  bool swapped = gap[axis] < 0;
+
+  nodes[index].nPrimitives = 0;
+  nodes[index].axis = axis;
+  if (swapped) {
+    flatten(prims, mid, end, level + 1);
+    nodes[index].secondChildOffset = flatten(prims, begin, mid, level + 1);
+  } else {
+    flatten(prims, begin, mid, level + 1);
+    nodes[index].secondChildOffset = flatten(prims, mid, end, level + 1);
+  }
+  return index;
+}
+
+template <typename T>
+inline bool LinearBVH<T>::hit(const Ray<T> &r, T tMin, T tMax,
+                              HitRecord<T> &rec) const {
+  if (nodes.empty())
+    return false;
+
+  const auto orig = r.origin();
+  const auto dir = r.direction();
+  const T invDir[3] = {1 / dir.x(), 1 / dir.y(), 1 / dir.z()};
+  const int dirIsNeg[3] = {invDir[0] < 0, invDir[1] < 0, invDir[2] < 0};
+
+  bool hitAnything = false;
+  auto closestSoFar = tMax;
+  uint32_t stack[stackSize];
+  int toVisit = 0;
+  uint32_t current = 0;
+  while (true) {
+    const auto &node = nodes[current];
+    count_ray_stat(&RayStats::nodeVisits);
+
+    // Slab test with the precomputed reciprocal direction.
+    T t0 = tMin, t1 = closestSoFar;
+    for (int a = 0; a < 3; ++a) {
+      T tNear = (node.bounds[dirIsNeg[a]][a] - orig[a]) * invDir[a];
+      T tFar = (node.bounds[1 - dirIsNeg[a]][a] - orig[a]) * invDir[a];
+      t0 = tNear > t0 ? tNear : t0;
+      t1 = tFar < t1 ? tFar : t1;
+    }
+
+    // Widening by 1 + 2 gamma(3) keeps grazing hits despite rounding.
+    if (t0 <= t1 * (1 + 2 * gamma<T>(3))) {
+      if (node.nPrimitives > 0) {
+        for (uint32_t i = 0; i < node.nPrimitives; ++i) {
+          if (primitives[node.primitivesOffset + i]->hit(r, tMin, closestSoFar,
+                                                          rec)) {
+            hitAnything = true;
+            closestSoFar = rec.t;
+          }
+        }
+        if (toVisit == 0)
+          break;
+        current = stack[--toVisit];
+      } else if (dirIsNeg[node.axis]) {
+        // The ray travels towards smaller coordinates: second child first.
+        stack[toVisit++] = current + 1;
+        current = node.secondChildOffset;
+      } else {
+        stack[toVisit++] = node.secondChildOffset;
+        current = current + 1;
+      }
+    } else {
+      if (toVisit == 0)
+        break;
+      current = stack[--toVisit];
+    }
+  }
+  return hitAnything;
+}
+
+/// Packet traversal: each node is tested against all lanes still active
+/// below it, and the packet only descends while at least one lane hits.
+/// Packets whose rays do not share an octant are traced lane by lane.
+template <typename T>
+inline uint32_t LinearBVH<T>::hit_packet(RayPacket<T> &packet, uint32_t mask,
+                                         HitRecord<T> *recs) const {
+  if (nodes.empty() || mask == 0)
+    return 0;
+  if (!packet.coherent(mask))
+    return Hittable<T>::hit_packet(packet, mask, recs);
+
+  int first = __builtin_ctz(mask);
+  int dirIsNeg[3];
+  for (int a = 0; a < 3; ++a)
+    dirIsNeg[a] = packet.invDir[a][first] < 0;
+
+  uint32_t hits = 0;
+  // Lanes that miss a box cannot hit anything inside it, so every stack
+  // entry carries the lanes that reached its parent.
+  uint32_t stack[stackSize], stackMask[stackSize];
+  int toVisit = 0;
+  uint32_t current = 0, currentMask = mask;
+  while (true) {
+    const auto &node = nodes[current];
+    count_ray_stat(&RayStats::nodeVisits);
+
+    float near[3], far[3];
+    for (int a = 0; a < 3; ++a) {
+      near[a] = node.bounds[dirIsNeg[a]][a];
+      far[a] = node.bounds[1 - dirIsNeg[a]][a];
+    }
+    uint32_t nodeMask = detail::packet_box(near, far, packet);
+    nodeMask &= currentMask;
+
+    if (nodeMask != 0 && node.nPrimitives == 0) {
+      stackMask[toVisit] = nodeMask;
+      currentMask = nodeMask;
+      if (dirIsNeg[node.axis]) {
+        stack[toVisit++] = current + 1;
+        current = node.secondChildOffset;
+      } else {
+        stack[toVisit++] = node.secondChildOffset;
+        current = current + 1;
+      }
+      continue;
+    }
+    if (nodeMask != 0) {
+      for (uint32_t i = 0; i < node.nPrimitives; ++i)
+        hits |= primitives[node.primitivesOffset + i]->hit_packet(
+            packet, nodeMask, recs);
+    }
+    if (toVisit == 0)
+      break;
+    --toVisit;
+    current = stack[toVisit];
+    currentMask = stackMask[toVisit];
+  }
+  return hits;
+}
+
+#endif /* LINEAR_BVH_H */
@@ -3,89 +3,164 @@
 #include "Hittable.h"
 #include "RTWeekend.h"
 #include "Ray.h"
+#include "RayStats.h"
+#include "Sampler.h"
 #include "Vec3.h"
 
-struct HitRecord;
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <variant>
+#include <vector>
 
-class Material {
+template <typename T> class Lambertian {
 public:
-  virtual bool scatter(const Ray<double> &inputRay, const HitRecord &rec,
-                       Color &attenuation, Ray<double> &scattered) const = 0;
-};
-
-class Lambertian : public Material {
-public:
-  Lambertian(const Color &a) : albedo(a) {}
-
-  virtual bool scatter(const Ray<double> &inputRay, const HitRecord &rec,
-                       Color &attenuation,
-                       Ray<double> &scattered) const override {
-    auto scatterDirection = rec.normal + random_unit_vector<double>();
+  Lambertian(const Vec3<T> &a) : albedo(a) {}
 
-    // catch degenerate scatter direction
-    if (scatterDirection.near_zero())
-      scatterDirection = rec.normal;
-
-    scattered = Ray<double>(rec.p, scatterDirection);
+  bool scatter(const Ray<T> &inputRay, const HitRecord<T> &rec,
+               Vec3<T> &attenuation, Ray<T> &scattered) const {
+    T u, v;
+    bounce_sample_2d(u, v);
+    scattered = spawn_ray(rec, cosine_direction(rec.normal, u, v));
     attenuation = albedo;
     return true;
   }
 
-  Color albedo;
+  Vec3<T> albedo;
 };
 
-class Metal : public Material {
+template <typename T> class Metal {
 public:
-  Metal(const Color &a, double f) : albedo(a), fuzz(f < 1 ? f : 1) {}
+  Metal(const Vec3<T> &a, T f) : albedo(a), fuzz(f < 1 ? f : 1) {}
 
-  virtual bool scatter(const Ray<double> &inputRay, const HitRecord &rec,
-                       Color &attenuation,
-                       Ray<double> &scattered) const override {
+  bool scatter(const Ray<T> &inputRay, const HitRecord<T> &rec,
+               Vec3<T> &attenuation, Ray<T> &scattered) const {
     auto reflected = reflect(unit_vector(inputRay.direction()), rec.normal);
-    scattered =
-        Ray<double>(rec.p, reflected + fuzz * random_in_unit_sphere<double>());
+    T u, v;
+    bounce_sample_2d(u, v);
+    auto inBall = ball_from_cube(u, v, random_t<T>());
+    scattered = spawn_ray(rec, reflected + fuzz * inBall);
     attenuation = albedo;
     return (dot(scattered.direction(), rec.normal) > 0);
   }
 
-  Color albedo;
-  double fuzz;
+  Vec3<T> albedo;
+  T fuzz;
 };
 
-class Dielectric : public Material {
+template <typename T> class Dielectric {
 public:
-  Dielectric(double index_of_refraction) : ir(index_of_refraction) {}
+  Dielectric(T index_of_refraction) : ir(index_of_refraction) {}
 
-  virtual bool scatter(const Ray<double> &r_in, const HitRecord &rec,
-                       Color &attenuation,
-                       Ray<double> &scattered) const override {
-    attenuation = Color(1.0, 1.0, 1.0);
-    double refraction_ratio = rec.frontFace ? (1.0 / ir) : ir;
+  bool scatter(const Ray<T> &r_in, const HitRecord<T> &rec,
+               Vec3<T> &attenuation, Ray<T> &scattered) const {
+    attenuation = Vec3<T>(1, 1, 1);
+    T refraction_ratio = rec.frontFace ? (1 / ir) : ir;
 
     auto unit_direction = unit_vector(r_in.direction());
-    double cos_theta = fmin(dot(-unit_direction, rec.normal), 1.0);
-    double sin_theta = sqrt(1.0 - cos_theta * cos_theta);
+    T cos_theta = std::fmin(dot(-unit_direction, rec.normal), T(1));
+    T sin_theta = std::sqrt(1 - cos_theta * cos_theta);
 
-    bool cannot_refract = refraction_ratio * sin_theta > 1.0;
-    Vec3<double> direction;
+    bool cannot_refract = refraction_ratio * sin_theta > 1;
+    Vec3<T> direction;
 
     if (cannot_refract ||
-        reflectance(cos_theta, refraction_ratio) > random_dbl())
+        reflectance(cos_theta, refraction_ratio) > random_t<T>())
       direction = reflect(unit_direction, rec.normal);
     else
       direction = refract(unit_direction, rec.normal, refraction_ratio);
 
-    scattered = Ray(rec.p, direction);
+    scattered = spawn_ray(rec, direction);
     return true;
   }
 
 private:
-  static double reflectance(double cosine, double refIdx) {
+  static T reflectance(T cosine, T refIdx) {
     auto r0 = (1 - refIdx) / (1 + refIdx);
     r0 = r0 * r0;
-    return r0 + (1 - r0) * pow((1 - cosine), 5);
+    T x = 1 - cosine;
+    return r0 + (1 - r0) * (x * x) * (x * x) * x;
   }
 
 public:
-  double ir; // Index of Refraction
+  T ir; // Index of Refraction
+};
+
+/// The closed set of materials. Shading switches on the alternative
+/// instead of going through a vtable, so each scatter() can be inlined.
+template <typename T>
+using Material = std::variant<Lambertian<T>, Metal<T>, Dielectric<T>>;
+
+/// Material kinds, in the order of Material's alternatives.
+enum class MaterialType : uint8_t { Lambertian, Metal, Dielectric };
+constexpr int materialTypeCount = 3;
+
+template <typename T> inline MaterialType material_type(const Material<T> &m) {
+  return static_cast<MaterialType>(m.index());
+}
+
+template <typename T>
+inline bool scatter(const Material<T> &m, const Ray<T> &inputRay,
+                    const HitRecord<T> &rec, Vec3<T> &attenuation,
+                    Ray<T> &scattered) {
+  count_scatter(int(material_type(m)));
+  switch (material_type(m)) {
+  case MaterialType::Lambertian:
+    return std::get_if<Lambertian<T>>(&m)->scatter(inputRay, rec, attenuation,
+                                                   scattered);
+  case MaterialType::Metal:
+    return std::get_if<Metal<T>>(&m)->scatter(inputRay, rec, attenuation,
+                                              scattered);
+  case MaterialType::Dielectric:
+    return std::get_if<Dielectric<T>>(&m)->scatter(inputRay, rec, attenuation,
+                                                   scattered);
+  }
+  return false;
+}
+
+/// Scene-owned storage for materials. Primitives and HitRecords refer to a
+/// material by its 32-bit index here instead of holding a shared_ptr, so a
+/// hit costs no reference counting.
+template <typename T> class MaterialTable {
+public:
+  /// Store a material in the table and return its index.
+  uint32_t add(const Material<T> &m) {
+    materials.push_back(m);
+    types.push_back(material_type(m));
+    return materials.size() - 1;
+  }
+
+  const Material<T> &operator[](uint32_t id) const { return materials[id]; }
+  size_t size() const { return materials.size(); }
+
+  /// Type of material id, read from a compact side array so binning hits
+  /// by type does not touch the materials themselves.
+  MaterialType type(uint32_t id) const { return types[id]; }
+
+  /// Reorder the table so materials of one type are contiguous (stable
+  /// within a type) and return the old-to-new index map, which primitives
+  /// must be updated with.
+  std::vector<uint32_t> sort_by_type() {
+    std::vector<uint32_t> order(materials.size());
+    for (uint32_t i = 0; i < order.size(); ++i)
+      order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+      return types[a] < types[b];
+    });
+
+    std::vector<uint32_t> remap(order.size());
+    std::vector<Material<T>> sorted;
+    sorted.reserve(order.size());
+    for (uint32_t i = 0; i < order.size(); ++i) {
+      remap[order[i]] = i;
+      sorted.push_back(materials[order[i]]);
+      types[i] = material_type(sorted.back());
+    }
+    materials = std::move(sorted);
+    return remap;
+  }
+
+private:
+  std::vector<Material<T>> materials;
+  std::vector<MaterialType> types;
 };
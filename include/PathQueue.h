@@ -0,0 +1,50 @@
+#pragma once
+
+#include "Ray.h"
+#include "Vec3.h"
+
+#include <cstdint>
+#include <vector>
+
+/// The live paths of a wavefront as structure of arrays: entry k holds the
+/// current ray, throughput and owning path id of one path. The wavefront
+/// stages sweep these arrays instead of following one path to its end.
+template <typename T> struct PathQueue {
+  size_t size() const { return path.size(); }
+
+  void reserve(size_t n) {
+    for (int a = 0; a < 3; ++a) {
+      org[a].reserve(n);
+      dir[a].reserve(n);
+    }
+    throughput.reserve(n);
+    path.reserve(n);
+  }
+
+  void clear() {
+    for (int a = 0; a < 3; ++a) {
+      org[a].clear();
+      dir[a].clear();
+    }
+    throughput.clear();
+    path.clear();
+  }
+
+  void push(const Ray<T> &r, const Vec3<T> &beta, uint32_t id) {
+    for (int a = 0; a < 3; ++a) {
+      org[a].push_back(r.orig[a]);
+      dir[a].push_back(r.dir[a]);
+    }
+    throughput.push_back(beta);
+    path.push_back(id);
+  }
+
+  Ray<T> ray(size_t k) const {
+    return Ray<T>(Vec3<T>(org[0][k], org[1][k], org[2][k]),
+                  Vec3<T>(dir[0][k], dir[1][k], dir[2][k]));
+  }
+
+  std::vector<T> org[3], dir[3];
+  std::vector<Vec3<T>> throughput;
+  std::vector<uint32_t> path; // index of the path within the wavefront
+};
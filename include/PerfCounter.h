@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+
+/// Hardware cache-miss counter of the calling thread, read through
+/// perf_event_open on Linux. Where the kernel or the hypervisor does not
+/// expose the counter (or off Linux), available() is false and read()
+/// returns 0, so callers can always bracket a region with two reads.
+class CacheMissCounter {
+public:
+  CacheMissCounter();
+  ~CacheMissCounter();
+  CacheMissCounter(const CacheMissCounter &) = delete;
+  CacheMissCounter &operator=(const CacheMissCounter &) = delete;
+
+  bool available() const { return fd >= 0; }
+  uint64_t read() const;
+
+private:
+  int fd = -1;
+};
+
+/// The counter of the calling thread, opened on first use.
+CacheMissCounter &thread_cache_misses();
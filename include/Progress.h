@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+/// Where render progress goes: a status line on stderr, one JSON object
+/// per report on stdout (for job schedulers), or nowhere.
+enum class ProgressStyle { Text, Json, Quiet };
+
+/// Work done by the calling thread that has not been passed on to a
+/// Progress yet. Plain thread-local counters, so the render loops pay one
+/// increment per sample and per ray.
+struct WorkCounters {
+  uint64_t samples = 0;
+  uint64_t rays = 0;
+};
+
+inline WorkCounters &thread_work() {
+  static thread_local WorkCounters work;
+  return work;
+}
+
+/// Progress of one render. Workers add their counters after each tile
+/// (add_thread_work), and a reporter thread prints a rate-limited line
+/// with the percentage done, Mrays/s and the time left.
+///
+/// The percentage and ETA come from the sample count when the total is
+/// known in advance, and from the clock under a time budget. Adaptive
+/// renders know neither, so they report the pass and the rate only.
+class Progress {
+public:
+  /// Start reporting in style every interval seconds. totalSamples is 0
+  /// when unknown; budget is the time budget in seconds, or 0.
+  Progress(ProgressStyle style, uint64_t totalSamples, double budget,
+           double interval = 0.5);
+  /// Stop the reporter after one last report.
+  ~Progress();
+  Progress(const Progress &) = delete;
+  Progress &operator=(const Progress &) = delete;
+
+  void set_pass(int pass) { this->pass = pass; }
+  /// Move the calling thread's counters (thread_work) into the totals.
+  void add_thread_work();
+  uint64_t rays_traced() const { return rays; }
+
+private:
+  void run();
+  void report(bool final);
+
+  using Clock = std::chrono::steady_clock;
+  ProgressStyle style;
+  uint64_t totalSamples;
+  double budget;
+  double interval;
+  Clock::time_point start = Clock::now();
+  std::atomic<uint64_t> samples{0};
+  std::atomic<uint64_t> rays{0};
+  std::atomic<int> pass{-1}; // -1 until set_pass (one-pass renders)
+  std::mutex mutex;          // guards stop
+  std::condition_variable wake;
+  bool stop = false;
+  std::thread thread;
+};
@@ -1,10 +1,12 @@
 #pragma once
 
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
 #include <limits>
 #include <memory>
-#include <random>
+
+#include "Random.h"
 
 const double INF = std::numeric_limits<double>::infinity();
 const double PI = 3.1415926535897932385;
@@ -13,6 +15,13 @@ inline double degrees_to_radians(double degrees) {
   return degrees * PI / 180.0;
 }
 
+/// Conservative bound on the relative rounding error of n floating-point
+/// operations (PBRT's gamma(n)).
+template <typename T> constexpr T gamma(int n) {
+  constexpr T eps = std::numeric_limits<T>::epsilon() * T(0.5);
+  return (n * eps) / (1 - n * eps);
+}
+
 template <typename T> inline T clamp(T x, T min, T max) {
   if (x < min)
     return min;
@@ -22,11 +31,9 @@ template <typename T> inline T clamp(T x, T min, T max) {
 }
 
 template <typename T> inline T random_t() {
-  static std::uniform_real_distribution<T> distribution((T)0.0, (T)1.0);
-  static std::mt19937 generator;
-  return distribution(generator);
+  return thread_rng().rng.uniform<T>();
 }
 
-template <typename T> inline double random_t(T min, T max) {
+template <typename T> inline T random_t(T min, T max) {
   return min + (max - min) * random_t<T>();
 }
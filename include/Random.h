@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstdint>
+
+/// PCG32 (O'Neill 2014): a 64-bit LCG with a permuted 32-bit output. The
+/// whole state is 16 bytes and seeding takes two steps, so the renderer can
+/// afford to reseed it for every path segment.
+class Pcg32 {
+public:
+  Pcg32() { seed(0x853c49e6748fea9bULL, 0xda3e39cb94b95bdbULL); }
+  Pcg32(uint64_t initState, uint64_t stream) { seed(initState, stream); }
+
+  void seed(uint64_t initState, uint64_t stream) {
+    state = 0;
+    inc = (stream << 1u) | 1u;
+    next_u32();
+    state += initState;
+    next_u32();
+  }
+
+  uint32_t next_u32() {
+    uint64_t old = state;
+    state = old * 6364136223846793005ULL + inc;
+    uint32_t xorshifted = static_cast<uint32_t>(((old >> 18u) ^ old) >> 27u);
+    uint32_t rot = static_cast<uint32_t>(old >> 59u);
+    return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+  }
+
+  /// Return a uniform real in [0,1)
+  template <typename T> T uniform();
+
+  uint64_t state;
+  uint64_t inc;
+};
+
+/// Map a 0.32 fixed-point value to [0,1). Floats keep the top 24 bits, so
+/// rounding can never produce 1.
+template <typename T> inline T fixed_to_unit(uint32_t bits);
+
+template <> inline double fixed_to_unit<double>(uint32_t bits) {
+  return bits * 0x1p-32;
+}
+
+template <> inline float fixed_to_unit<float>(uint32_t bits) {
+  return (bits >> 8) * 0x1p-24f;
+}
+
+template <typename T> inline T Pcg32::uniform() {
+  return fixed_to_unit<T>(next_u32());
+}
+
+/// SplitMix64 finalizer, used to turn structured keys into seeds.
+inline uint64_t mix_bits(uint64_t v) {
+  v ^= v >> 31;
+  v *= 0x7fb5d329728ea185ULL;
+  v ^= v >> 27;
+  v *= 0x81dadef4bc2dd44dULL;
+  v ^= v >> 33;
+  return v;
+}
+
+class Sampler;
+
+/// The random stream of one path. Every (seed, pixel, sample, bounce) key
+/// selects its own PCG32 sequence, so the numbers a path sees depend only
+/// on which path and bounce it is, never on thread scheduling or on how
+/// many numbers earlier bounces consumed. The path's sampler, if any,
+/// supplies its pixel, lens and scatter samples (see sample_2d).
+///
+/// start_path selects the camera's sequence (pixel jitter and lens) and
+/// start_bounce(b) that of bounce b, so no bounce reuses the numbers the
+/// camera drew.
+struct PathRng {
+  void start_path(uint64_t seed, uint32_t pixel, uint32_t sample,
+                  const Sampler *pathSampler = nullptr) {
+    key = mix_bits(seed ^ (uint64_t(sample) << 32));
+    stream = pixel;
+    this->pixel = pixel;
+    this->sample = sample;
+    sampler = pathSampler;
+    bounce = 0;
+    rng.seed(mix_bits(key), stream);
+  }
+
+  void start_bounce(uint32_t bounce) {
+    this->bounce = bounce;
+    rng.seed(mix_bits(key + bounce + 1), stream);
+  }
+
+  Pcg32 rng;
+  uint64_t key = 0;
+  uint64_t stream = 0;
+  const Sampler *sampler = nullptr;
+  uint32_t pixel = 0, sample = 0, bounce = 0;
+};
+
+/// Each thread owns its generator, so parallel renders never share state.
+inline PathRng &thread_rng() {
+  static thread_local PathRng rng;
+  return rng;
+}
@@ -4,15 +4,15 @@
 template <typename T> class Ray {
 public:
   Ray() {}
-  Ray(const Point3 &origin, const Vec3<T> &direction)
+  Ray(const Vec3<T> &origin, const Vec3<T> &direction)
       : orig(origin), dir(direction) {}
 
-  Point3 origin() const { return orig; }
+  Vec3<T> origin() const { return orig; }
   Vec3<T> direction() const { return dir; }
 
-  Point3 at(T t) const { return orig + t * dir; }
+  Vec3<T> at(T t) const { return orig + t * dir; }
 
 public:
-  Point3 orig;
+  Vec3<T> orig;
   Vec3<T> dir;
 };
@@ -0,0 +1,152 @@
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+#include "RTWeekend.h"
+#include "Ray.h"
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RT_X86 1
+#include <immintrin.h>
+#endif
+
+/// A packet of rays in structure-of-arrays form, so a box or sphere test
+/// runs the same arithmetic on every lane and the compiler can vectorize it.
+/// Lanes are selected with bitmasks; bit i stands for lane i.
+template <typename T> struct alignas(32) RayPacket {
+  static constexpr int size = 8;
+  static constexpr uint32_t allLanes = (1u << size) - 1;
+
+  void set(int lane, const Ray<T> &r) {
+    for (int a = 0; a < 3; ++a) {
+      org[a][lane] = r.orig[a];
+      dir[a][lane] = r.dir[a];
+      invDir[a][lane] = 1 / r.dir[a];
+    }
+    tMax[lane] = std::numeric_limits<T>::infinity();
+  }
+
+  Ray<T> ray(int lane) const {
+    return Ray<T>(Vec3<T>(org[0][lane], org[1][lane], org[2][lane]),
+                  Vec3<T>(dir[0][lane], dir[1][lane], dir[2][lane]));
+  }
+
+  /// True if the direction signs of all lanes in mask agree (judged on
+  /// invDir, so -0 counts as negative). Packet traversal picks box slabs
+  /// and child order once for the whole packet, which needs every ray to
+  /// travel into the same octant.
+  bool coherent(uint32_t mask) const {
+    int first = __builtin_ctz(mask);
+    for (int a = 0; a < 3; ++a) {
+      bool neg = invDir[a][first] < 0;
+      for (int l = 0; l < size; ++l)
+        if ((mask >> l & 1) && (invDir[a][l] < 0) != neg)
+          return false;
+    }
+    return true;
+  }
+
+  T org[3][size];
+  T dir[3][size];
+  T invDir[3][size];
+  T tMax[size]; // closest hit found so far in each lane
+};
+
+namespace detail {
+
+/// Slab test of every lane against a box whose near and far planes per axis
+/// are given (already picked by the packet's shared direction signs).
+/// Returns the mask of lanes whose [0, tMax] overlaps the box, with the
+/// same arithmetic and widening as LinearBVH::hit.
+template <typename T>
+inline uint32_t packet_box_scalar(const float near[3], const float far[3],
+                                  const RayPacket<T> &p) {
+  uint32_t mask = 0;
+  for (int l = 0; l < RayPacket<T>::size; ++l) {
+    T t0 = 0, t1 = p.tMax[l];
+    for (int a = 0; a < 3; ++a) {
+      T tNear = (near[a] - p.org[a][l]) * p.invDir[a][l];
+      T tFar = (far[a] - p.org[a][l]) * p.invDir[a][l];
+      t0 = tNear > t0 ? tNear : t0;
+      t1 = tFar < t1 ? tFar : t1;
+    }
+    mask |= uint32_t(t0 <= t1 * (1 + 2 * gamma<T>(3))) << l;
+  }
+  return mask;
+}
+
+#ifdef RT_X86
+/// Whether the packet kernels below may be used on this CPU.
+inline bool packet_avx2() {
+  static const bool avx2 = __builtin_cpu_supports("avx2");
+  return avx2;
+}
+
+// The AVX2 packet kernels (this one and packet_sphere_avx2 in Sphere.h)
+// mirror the scalar ones operation for operation, with max/min and ordered
+// compares treating NaN like the ternaries, so either gives the same image.
+// Eight float lanes fill one register; double packets go in two halves.
+
+__attribute__((target("avx2"))) inline uint32_t
+packet_box_avx2(const float near[3], const float far[3],
+                const RayPacket<float> &p) {
+  __m256 t0 = _mm256_setzero_ps();
+  __m256 t1 = _mm256_load_ps(p.tMax);
+  for (int a = 0; a < 3; ++a) {
+    __m256 o = _mm256_load_ps(p.org[a]);
+    __m256 inv = _mm256_load_ps(p.invDir[a]);
+    __m256 tNear = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(near[a]), o),
+                                 inv);
+    __m256 tFar = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(far[a]), o),
+                                inv);
+    t0 = _mm256_max_ps(tNear, t0);
+    t1 = _mm256_min_ps(tFar, t1);
+  }
+  __m256 widen = _mm256_set1_ps(1 + 2 * gamma<float>(3));
+  return _mm256_movemask_ps(
+      _mm256_cmp_ps(t0, _mm256_mul_ps(t1, widen), _CMP_LE_OQ));
+}
+
+__attribute__((target("avx2"))) inline uint32_t
+packet_box_avx2(const float near[3], const float far[3],
+                const RayPacket<double> &p) {
+  uint32_t mask = 0;
+  for (int h = 0; h < 8; h += 4) {
+    __m256d t0 = _mm256_setzero_pd();
+    __m256d t1 = _mm256_load_pd(p.tMax + h);
+    for (int a = 0; a < 3; ++a) {
+      __m256d o = _mm256_load_pd(p.org[a] + h);
+      __m256d inv = _mm256_load_pd(p.invDir[a] + h);
+      __m256d tNear = _mm256_mul_pd(
+          _mm256_sub_pd(_mm256_set1_pd(near[a]), o), inv);
+      __m256d tFar = _mm256_mul_pd(
+          _mm256_sub_pd(_mm256_set1_pd(far[a]), o), inv);
+      t0 = _mm256_max_pd(tNear, t0);
+      t1 = _mm256_min_pd(tFar, t1);
+    }
+    __m256d widen = _mm256_set1_pd(1 + 2 * gamma<double>(3));
+    mask |= uint32_t(_mm256_movemask_pd(_mm256_cmp_pd(
+                t0, _mm256_mul_pd(t1, widen), _CMP_LE_OQ)))
+            << h;
+  }
+  return mask;
+}
+
+#endif
+
+template <typename T>
+inline uint32_t packet_box(const float near[3], const float far[3],
+                           const RayPacket<T> &p) {
+#ifdef RT_X86
+  if (packet_avx2())
+    return packet_box_avx2(near, far, p);
+#endif
+  return packet_box_scalar(near, far, p);
+}
+
+} // namespace detail
+
+#endif /* RAY_PACKET_H */
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iosfwd>
+#include <mutex>
+
+/// Whether the counters below are compiled in (-DFRT_RAY_STATS). Without
+/// it every count_* call is an empty inline function.
+#ifdef FRT_RAY_STATS
+constexpr bool rayStatsEnabled = true;
+#else
+constexpr bool rayStatsEnabled = false;
+#endif
+
+/// How a path ended.
+enum class PathEnd : uint8_t { Escaped, Absorbed, Roulette, DepthLimit };
+constexpr int pathEndCount = 4;
+
+/// Counters of one thread's tracing work. Each thread counts into its own
+/// copy (thread_ray_stats), which is added to a global total when the
+/// thread exits; collect_ray_stats sums them at the end of a render.
+struct RayStats {
+  static constexpr int depthBins = 64;  // the last bin takes deeper paths
+  static constexpr int materialBins = 8; // indexed by MaterialType
+
+  uint64_t primaryRays = 0;   // camera rays
+  uint64_t secondaryRays = 0; // scattered rays
+  uint64_t pathEnds[pathEndCount] = {}; // terminated paths, by PathEnd
+  uint64_t sphereTests = 0; // ray/sphere tests (lanes, for packets)
+  uint64_t sphereHits = 0;  // tests with a root in range
+  uint64_t nodeVisits = 0;  // BVH nodes entered (per packet, for packets)
+  uint64_t listVisits = 0;  // HittableList objects walked (per packet)
+  uint64_t depthHistogram[depthBins] = {}; // bounces before a path ended
+  uint64_t scatters[materialBins] = {};    // scatter() calls by material
+
+  RayStats &operator+=(const RayStats &o) {
+    primaryRays += o.primaryRays;
+    secondaryRays += o.secondaryRays;
+    for (int k = 0; k < pathEndCount; ++k)
+      pathEnds[k] += o.pathEnds[k];
+    sphereTests += o.sphereTests;
+    sphereHits += o.sphereHits;
+    nodeVisits += o.nodeVisits;
+    listVisits += o.listVisits;
+    for (int k = 0; k < depthBins; ++k)
+      depthHistogram[k] += o.depthHistogram[k];
+    for (int k = 0; k < materialBins; ++k)
+      scatters[k] += o.scatters[k];
+    return *this;
+  }
+};
+
+namespace detail {
+inline std::mutex rayStatsMutex;
+inline RayStats rayStatsTotal; // threads that have exited
+
+struct ThreadRayStats {
+  RayStats stats;
+  ~ThreadRayStats() {
+    std::lock_guard<std::mutex> lock(rayStatsMutex);
+    rayStatsTotal += stats;
+  }
+};
+inline thread_local ThreadRayStats threadRayStats;
+} // namespace detail
+
+/// The calling thread's counters.
+inline RayStats &thread_ray_stats() { return detail::threadRayStats.stats; }
+
+inline void count_ray_stat(uint64_t RayStats::*counter, uint64_t n = 1) {
+  if constexpr (rayStatsEnabled)
+    thread_ray_stats().*counter += n;
+}
+
+inline void count_path_end(PathEnd end, int bounces) {
+  if constexpr (rayStatsEnabled) {
+    RayStats &s = thread_ray_stats();
+    ++s.pathEnds[int(end)];
+    ++s.depthHistogram[std::min(bounces, RayStats::depthBins - 1)];
+  }
+}
+
+inline void count_scatter(int materialType) {
+  if constexpr (rayStatsEnabled)
+    ++thread_ray_stats().scatters[materialType];
+}
+
+/// Totals of all threads that have exited plus the calling thread.
+inline RayStats collect_ray_stats() {
+  std::lock_guard<std::mutex> lock(detail::rayStatsMutex);
+  RayStats sum = detail::rayStatsTotal;
+  sum += thread_ray_stats();
+  return sum;
+}
+
+/// Human-readable summary, as printed by --stats.
+void print_ray_stats(std::ostream &out, const RayStats &stats,
+                     double seconds);
+/// The same numbers as one JSON object.
+void write_ray_stats_json(std::ostream &out, const RayStats &stats,
+                          double seconds);
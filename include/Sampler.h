@@ -0,0 +1,114 @@
+#pragma once
+
+#include "Random.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/// Two sample values in 0.32 fixed point, i.e. x * 2^-32 lies in [0,1).
+struct Sample2D {
+  uint32_t x, y;
+};
+
+/// The 2D dimensions a path draws from its sampler. Everything else (the
+/// dielectric's extra choices, Russian roulette) stays on the path's PCG32
+/// stream.
+enum SampleDim : uint32_t {
+  PixelDim = 0, // jitter within the pixel
+  LensDim = 1,  // point on the lens
+  BounceDim = 2 // scatter direction of bounce b is BounceDim + b
+};
+
+/// Source of the sample values of the paths through a pixel. Samplers are
+/// stateless: a value depends only on (pixel, sample, dimension), so one
+/// sampler is shared by all render threads and a render stays independent
+/// of scheduling, exactly like the PCG32 streams.
+class Sampler {
+public:
+  virtual ~Sampler() = default;
+  virtual Sample2D get_2d(uint32_t pixel, uint32_t sample,
+                          uint32_t dim) const = 0;
+};
+
+/// Independent uniform values hashed from (pixel, sample, dimension); plain
+/// Monte Carlo. Unlike the path's PCG32 stream, a dimension never sees the
+/// numbers another dimension drew.
+class IndependentSampler : public Sampler {
+public:
+  explicit IndependentSampler(uint64_t seed) : seed(seed) {}
+  Sample2D get_2d(uint32_t pixel, uint32_t sample, uint32_t dim) const override;
+
+private:
+  uint64_t seed;
+};
+
+/// Jittered strata on an nx x ny grid with nx * ny >= samplesPerPixel.
+/// Each dimension visits the strata in its own random order per pixel, so
+/// dimensions do not correlate.
+class StratifiedSampler : public Sampler {
+public:
+  StratifiedSampler(int samplesPerPixel, uint64_t seed);
+  Sample2D get_2d(uint32_t pixel, uint32_t sample, uint32_t dim) const override;
+
+private:
+  uint32_t nx, ny;
+  uint64_t seed;
+};
+
+/// The first two Sobol dimensions with hash-based Owen scrambling (Burley
+/// 2020). Every (pixel, dimension) pair gets its own scramble and its own
+/// shuffle of the sample index, which pads the 2D sequence out to any
+/// number of dimensions. Any prefix of a power of two samples is well
+/// stratified, so this converges fastest when --spp is a power of two.
+class SobolSampler : public Sampler {
+public:
+  explicit SobolSampler(uint64_t seed) : seed(seed) {}
+  Sample2D get_2d(uint32_t pixel, uint32_t sample, uint32_t dim) const override;
+
+private:
+  uint64_t seed;
+};
+
+/// The same Sobol points at every pixel, toroidally shifted by a blue-noise
+/// mask (Georgiev and Fajardo 2016). Neighbouring pixels then have errors
+/// that do not correlate at low frequencies, so the remaining noise looks
+/// like fine grain rather than blotches, most visibly at low spp.
+class BlueNoiseSampler : public Sampler {
+public:
+  BlueNoiseSampler(int width, uint64_t seed);
+  Sample2D get_2d(uint32_t pixel, uint32_t sample, uint32_t dim) const override;
+
+  static constexpr int maskSize = 64;
+
+private:
+  int width;
+  uint64_t seed;
+  std::vector<uint32_t> mask; // maskSize^2 values in 0.32 fixed point
+};
+
+/// Create the sampler called name (random|stratified|sobol|bluenoise), or
+/// return nullptr if there is no such sampler.
+std::unique_ptr<Sampler> make_sampler(const std::string &name,
+                                      int samplesPerPixel, int width,
+                                      uint64_t seed);
+
+/// The current path's 2D sample for dimension dim, from the sampler passed
+/// to start_path, or two uniform draws when there is none.
+template <typename T> inline void sample_2d(uint32_t dim, T &u, T &v) {
+  PathRng &rng = thread_rng();
+  if (!rng.sampler) {
+    u = rng.rng.uniform<T>();
+    v = rng.rng.uniform<T>();
+    return;
+  }
+  Sample2D s = rng.sampler->get_2d(rng.pixel, rng.sample, dim);
+  u = fixed_to_unit<T>(s.x);
+  v = fixed_to_unit<T>(s.y);
+}
+
+/// The 2D sample the current bounce scatters with.
+template <typename T> inline void bounce_sample_2d(T &u, T &v) {
+  sample_2d(BounceDim + thread_rng().bounce, u, v);
+}
@@ -0,0 +1,163 @@
+#pragma once
+
+#include "Camera.h"
+#include "HittableList.h"
+#include "Material.h"
+#include "RTWeekend.h"
+#include "Sphere.h"
+#include "Vec3.h"
+
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/// The scenes the renderer and raytracer_bench know, by name.
+inline const std::vector<std::string> &scene_names() {
+  static const std::vector<std::string> names = {"random", "field", "glass"};
+  return names;
+}
+
+template <typename T>
+HittableList<T> random_scene(MaterialTable<T> &materials) {
+  HittableList<T> world;
+
+  auto ground_material = materials.add(Lambertian<T>(Vec3<T>(0.5, 0.5, 0.5)));
+  world.add(std::make_shared<Sphere<T>>(Vec3<T>(0, -1000, 0), 1000,
+                                        ground_material));
+
+  for (int a = -11; a < 11; a++) {
+    for (int b = -11; b < 11; b++) {
+      auto choose_mat = random_dbl();
+      Point3 center(a + 0.9 * random_dbl(), 0.2, b + 0.9 * random_dbl());
+
+      if ((center - Point3(4, 0.2, 0)).length() > 0.9) {
+        uint32_t sphere_material;
+
+        if (choose_mat < 0.8) {
+          // diffuse
+          auto albedo = Color::rand() * Color::rand();
+          sphere_material = materials.add(Lambertian<T>(Vec3<T>(albedo)));
+        } else if (choose_mat < 0.95) {
+          // metal
+          auto albedo = Color::rand(0.5, 1);
+          auto fuzz = random_dbl(0, 0.5);
+          sphere_material = materials.add(Metal<T>(Vec3<T>(albedo), fuzz));
+        } else {
+          // glass
+          sphere_material = materials.add(Dielectric<T>(1.5));
+        }
+        world.add(std::make_shared<Sphere<T>>(Vec3<T>(center), 0.2,
+                                              sphere_material));
+      }
+    }
+  }
+
+  auto material1 = materials.add(Dielectric<T>(1.5));
+  world.add(std::make_shared<Sphere<T>>(Vec3<T>(0, 1, 0), 1.0, material1));
+
+  auto material2 = materials.add(Lambertian<T>(Vec3<T>(0.4, 0.2, 0.1)));
+  world.add(std::make_shared<Sphere<T>>(Vec3<T>(-4, 1, 0), 1.0, material2));
+
+  auto material3 = materials.add(Metal<T>(Vec3<T>(0.7, 0.6, 0.5), 0.0));
+  world.add(std::make_shared<Sphere<T>>(Vec3<T>(4, 1, 0), 1.0, material3));
+
+  return world;
+}
+
+/// n small spheres scattered over a square on the ground, about one per
+/// unit of area, seen at a grazing angle so that rays cross deep into the
+/// field: a stress test for the acceleration structure.
+template <typename T>
+HittableList<T> sphere_field_scene(MaterialTable<T> &materials,
+                                   size_t n = 100000) {
+  HittableList<T> world;
+  world.objects.reserve(n + 1);
+  auto ground = materials.add(Lambertian<T>(Vec3<T>(0.5, 0.5, 0.5)));
+  world.add(
+      std::make_shared<Sphere<T>>(Vec3<T>(0, -1000, 0), 1000, ground));
+
+  // A handful of shared materials; only the geometry is large.
+  uint32_t palette[8];
+  for (int k = 0; k < 6; ++k)
+    palette[k] = materials.add(Lambertian<T>(Vec3<T>(Color::rand(0.1, 0.9))));
+  palette[6] = materials.add(Metal<T>(Vec3<T>(0.8, 0.8, 0.8), 0.1));
+  palette[7] = materials.add(Dielectric<T>(1.5));
+
+  const double side = std::sqrt(double(n));
+  for (size_t i = 0; i < n; ++i) {
+    double x = (random_dbl() - 0.5) * side, z = -random_dbl() * side;
+    double radius = random_dbl(0.1, 0.3);
+    world.add(std::make_shared<Sphere<T>>(Vec3<T>(x, radius, z), radius,
+                                          palette[i % 8]));
+  }
+  return world;
+}
+
+/// random_scene's layout with every small sphere made of glass or water:
+/// long paths of refraction and total internal reflection.
+template <typename T> HittableList<T> glass_scene(MaterialTable<T> &materials) {
+  HittableList<T> world;
+  auto ground = materials.add(Lambertian<T>(Vec3<T>(0.5, 0.5, 0.5)));
+  world.add(
+      std::make_shared<Sphere<T>>(Vec3<T>(0, -1000, 0), 1000, ground));
+
+  auto glass = materials.add(Dielectric<T>(1.5));
+  auto water = materials.add(Dielectric<T>(1.33));
+  for (int a = -11; a < 11; a++) {
+    for (int b = -11; b < 11; b++) {
+      Point3 center(a + 0.9 * random_dbl(), 0.2, b + 0.9 * random_dbl());
+      if ((center - Point3(4, 0.2, 0)).length() <= 0.9)
+        continue;
+      auto material = random_dbl() < 0.7 ? glass : water;
+      world.add(std::make_shared<Sphere<T>>(Vec3<T>(center), 0.2, material));
+    }
+  }
+
+  world.add(std::make_shared<Sphere<T>>(Vec3<T>(0, 1, 0), 1.0, glass));
+  world.add(std::make_shared<Sphere<T>>(Vec3<T>(-4, 1, 0), 1.0, water));
+  auto metal = materials.add(Metal<T>(Vec3<T>(0.7, 0.6, 0.5), 0.0));
+  world.add(std::make_shared<Sphere<T>>(Vec3<T>(4, 1, 0), 1.0, metal));
+  return world;
+}
+
+/// Build the scene called name, or return false if there is none. The
+/// scene's random numbers come from a fixed seed, so every build of a
+/// scene is the same.
+template <typename T>
+bool build_scene(const std::string &name, MaterialTable<T> &materials,
+                 HittableList<T> &world) {
+  thread_rng().rng = Pcg32();
+  if (name == "random")
+    world = random_scene(materials);
+  else if (name == "field")
+    world = sphere_field_scene(materials);
+  else if (name == "glass")
+    world = glass_scene(materials);
+  else
+    return false;
+  return true;
+}
+
+/// Renumber the material ids of the spheres in world after the material
+/// table has been reordered.
+template <typename T>
+void remap_materials(HittableList<T> &world,
+                     const std::vector<uint32_t> &remap) {
+  for (auto &obj : world.objects)
+    if (auto sphere = std::dynamic_pointer_cast<Sphere<T>>(obj))
+      sphere->matId = remap[sphere->matId];
+}
+
+/// The camera that frames the scene called name.
+template <typename T>
+Camera<T> scene_camera(const std::string &name, T aspectRatio) {
+  if (name == "field")
+    return Camera<T>(/*lookfrom*/ Vec3<T>(0., 3., 4.),
+                     /*lookat*/ Vec3<T>(0., 0., -40.),
+                     /*vup*/ Vec3<T>(0., 1., 0.), 40, aspectRatio, 0.0, 40.0);
+  return Camera<T>(/*lookfrom*/ Vec3<T>(13., 2., 3.),
+                   /*lookat*/ Vec3<T>(0., 0., 0.), /*vup*/ Vec3<T>(0., 1., 0.),
+                   20, aspectRatio, 0.1, 10.0);
+}
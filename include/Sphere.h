@@ -2,49 +2,240 @@
 #define SPHERE_H
 
 #include "Hittable.h"
+#include "RayStats.h"
 #include "Vec3.h"
 
-class Sphere : public Hittable {
-public:
-  Sphere() {}
-  Sphere(Point3 cen, double r, std::shared_ptr<Material> m)
-      : center(cen), radius(r), matPtr(m){};
-
-  virtual bool hit(const Ray<double> &r, double tMin, double tMax,
-                   HitRecord &rec) const override;
-
-  Point3 center;
-  double radius;
-  std::shared_ptr<Material> matPtr;
-};
+#include <cmath>
 
-inline bool Sphere::hit(const Ray<double> &r, double tMin, double tMax,
-                        HitRecord &rec) const {
-  Vec3<double> oc = r.origin() - center;
-  auto a = r.direction().length_squared();
-  auto half_b = dot(oc, r.direction());
+/// Solve the ray/sphere quadratic for oc = origin - center and direction d
+/// (a = |d|^2) and return the nearest root in [tMin, tMax]. The roots are
+/// computed as q / a and c / q with q = -(half_b + sign(half_b) sqrt(disc)),
+/// which avoids the cancellation in -half_b + sqrt(disc) that would turn
+/// the root at the ray origin into noise. The comparisons are written to
+/// reject NaN roots from tangent rays.
+template <typename T>
+inline bool sphere_root(const Vec3<T> &oc, const Vec3<T> &d, T a, T radius,
+                        T tMin, T tMax, T &root) {
+  auto half_b = dot(oc, d);
   auto c = oc.length_squared() - radius * radius;
 
   auto discriminant = half_b * half_b - a * c;
   if (discriminant < 0)
     return false;
-  auto sqrtd = sqrt(discriminant);
+  auto q = -(half_b + std::copysign(std::sqrt(discriminant), half_b));
+  auto t0 = q / a;
+  auto t1 = c / q;
+  if (t1 < t0)
+    std::swap(t0, t1);
 
   // Find the nearest root that lies in the acceptable range.
-  auto root = (-half_b - sqrtd) / a;
-  if (root < tMin || tMax < root) {
-    root = (-half_b + sqrtd) / a;
-    if (root < tMin || tMax < root)
+  root = t0;
+  if (!(tMin <= root && root <= tMax)) {
+    root = t1;
+    if (!(tMin <= root && root <= tMax))
       return false;
   }
+  return true;
+}
+
+/// Fill rec for a hit at parameter t on a sphere. The point is projected
+/// back onto the sphere, which bounds its error by a few ulps of its
+/// magnitude whatever the error in t was.
+template <typename T>
+inline void set_sphere_hit(const Ray<T> &r, T t, const Vec3<T> &center,
+                           T radius, uint32_t matId, HitRecord<T> &rec) {
+  Vec3<T> rel = r.at(t) - center;
+  rel *= radius / rel.length();
+  rec.t = t;
+  rec.p = center + rel;
+  rec.error = gamma<T>(5) * (radius + max_abs(rec.p));
+  rec.set_face_normal(r, rel / radius);
+  rec.matId = matId;
+}
+
+namespace detail {
+
+/// sphere_root() for every lane over [0, tMax]: returns the mask of lanes
+/// with a root in range and stores those roots in root.
+template <typename T>
+inline uint32_t packet_sphere_scalar(const Vec3<T> &center, T radius,
+                                     const RayPacket<T> &p, T *root) {
+  uint32_t mask = 0;
+  for (int l = 0; l < RayPacket<T>::size; ++l) {
+    Vec3<T> oc(p.org[0][l] - center.x(), p.org[1][l] - center.y(),
+               p.org[2][l] - center.z());
+    Vec3<T> d(p.dir[0][l], p.dir[1][l], p.dir[2][l]);
+    if (sphere_root(oc, d, d.length_squared(), radius, T(0), p.tMax[l],
+                    root[l]))
+      mask |= 1u << l;
+  }
+  return mask;
+}
+
+#ifdef RT_X86
+__attribute__((target("avx2"))) inline uint32_t
+packet_sphere_avx2(const Vec3<float> &center, float radius,
+                   const RayPacket<float> &p, float *root) {
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 signMask = _mm256_set1_ps(-0.0f);
+  __m256 ocx = _mm256_sub_ps(_mm256_load_ps(p.org[0]),
+                             _mm256_set1_ps(center.x()));
+  __m256 ocy = _mm256_sub_ps(_mm256_load_ps(p.org[1]),
+                             _mm256_set1_ps(center.y()));
+  __m256 ocz = _mm256_sub_ps(_mm256_load_ps(p.org[2]),
+                             _mm256_set1_ps(center.z()));
+  __m256 dx = _mm256_load_ps(p.dir[0]), dy = _mm256_load_ps(p.dir[1]),
+         dz = _mm256_load_ps(p.dir[2]);
+  __m256 a = _mm256_add_ps(
+      _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+      _mm256_mul_ps(dz, dz));
+  __m256 halfB = _mm256_add_ps(
+      _mm256_add_ps(_mm256_mul_ps(ocx, dx), _mm256_mul_ps(ocy, dy)),
+      _mm256_mul_ps(ocz, dz));
+  __m256 c = _mm256_sub_ps(
+      _mm256_add_ps(
+          _mm256_add_ps(_mm256_mul_ps(ocx, ocx), _mm256_mul_ps(ocy, ocy)),
+          _mm256_mul_ps(ocz, ocz)),
+      _mm256_set1_ps(radius * radius));
+  __m256 disc =
+      _mm256_sub_ps(_mm256_mul_ps(halfB, halfB), _mm256_mul_ps(a, c));
+  __m256 hasRoots = _mm256_cmp_ps(disc, zero, _CMP_GE_OQ);
+  if (!_mm256_movemask_ps(hasRoots))
+    return 0;
+
+  __m256 sqrtd = _mm256_sqrt_ps(_mm256_max_ps(disc, zero));
+  __m256 signedSqrt = _mm256_or_ps(sqrtd, _mm256_and_ps(halfB, signMask));
+  __m256 q = _mm256_xor_ps(_mm256_add_ps(halfB, signedSqrt), signMask);
+  __m256 t0 = _mm256_div_ps(q, a);
+  __m256 t1 = _mm256_div_ps(c, q);
+  __m256 lo = _mm256_min_ps(t1, t0);
+  __m256 hi = _mm256_max_ps(t0, t1);
 
-  rec.t = root;
-  rec.p = r.at(rec.t);
-  Vec3<double> outwardNormal = (rec.p - center) / radius;
-  rec.set_face_normal(r, outwardNormal);
-  rec.matPtr = matPtr;
+  __m256 tMax = _mm256_load_ps(p.tMax);
+  __m256 loOk = _mm256_and_ps(_mm256_cmp_ps(zero, lo, _CMP_LE_OQ),
+                              _mm256_cmp_ps(lo, tMax, _CMP_LE_OQ));
+  __m256 hiOk = _mm256_and_ps(_mm256_cmp_ps(zero, hi, _CMP_LE_OQ),
+                              _mm256_cmp_ps(hi, tMax, _CMP_LE_OQ));
+  _mm256_storeu_ps(root, _mm256_blendv_ps(hi, lo, loOk));
+  return _mm256_movemask_ps(_mm256_and_ps(hasRoots, _mm256_or_ps(loOk, hiOk)));
+}
+
+__attribute__((target("avx2"))) inline uint32_t
+packet_sphere_avx2(const Vec3<double> &center, double radius,
+                   const RayPacket<double> &p, double *root) {
+  const __m256d zero = _mm256_setzero_pd();
+  const __m256d signMask = _mm256_set1_pd(-0.0);
+  uint32_t mask = 0;
+  for (int h = 0; h < 8; h += 4) {
+    __m256d ocx = _mm256_sub_pd(_mm256_load_pd(p.org[0] + h),
+                                _mm256_set1_pd(center.x()));
+    __m256d ocy = _mm256_sub_pd(_mm256_load_pd(p.org[1] + h),
+                                _mm256_set1_pd(center.y()));
+    __m256d ocz = _mm256_sub_pd(_mm256_load_pd(p.org[2] + h),
+                                _mm256_set1_pd(center.z()));
+    __m256d dx = _mm256_load_pd(p.dir[0] + h),
+            dy = _mm256_load_pd(p.dir[1] + h),
+            dz = _mm256_load_pd(p.dir[2] + h);
+    __m256d a = _mm256_add_pd(
+        _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)),
+        _mm256_mul_pd(dz, dz));
+    __m256d halfB = _mm256_add_pd(
+        _mm256_add_pd(_mm256_mul_pd(ocx, dx), _mm256_mul_pd(ocy, dy)),
+        _mm256_mul_pd(ocz, dz));
+    __m256d c = _mm256_sub_pd(
+        _mm256_add_pd(
+            _mm256_add_pd(_mm256_mul_pd(ocx, ocx), _mm256_mul_pd(ocy, ocy)),
+            _mm256_mul_pd(ocz, ocz)),
+        _mm256_set1_pd(radius * radius));
+    __m256d disc =
+        _mm256_sub_pd(_mm256_mul_pd(halfB, halfB), _mm256_mul_pd(a, c));
+    __m256d hasRoots = _mm256_cmp_pd(disc, zero, _CMP_GE_OQ);
+    if (!_mm256_movemask_pd(hasRoots))
+      continue;
+
+    __m256d sqrtd = _mm256_sqrt_pd(_mm256_max_pd(disc, zero));
+    __m256d signedSqrt =
+        _mm256_or_pd(sqrtd, _mm256_and_pd(halfB, signMask));
+    __m256d q = _mm256_xor_pd(_mm256_add_pd(halfB, signedSqrt), signMask);
+    __m256d t0 = _mm256_div_pd(q, a);
+    __m256d t1 = _mm256_div_pd(c, q);
+    __m256d lo = _mm256_min_pd(t1, t0);
+    __m256d hi = _mm256_max_pd(t0, t1);
 
+    __m256d tMax = _mm256_load_pd(p.tMax + h);
+    __m256d loOk = _mm256_and_pd(_mm256_cmp_pd(zero, lo, _CMP_LE_OQ),
+                                 _mm256_cmp_pd(lo, tMax, _CMP_LE_OQ));
+    __m256d hiOk = _mm256_and_pd(_mm256_cmp_pd(zero, hi, _CMP_LE_OQ),
+                                 _mm256_cmp_pd(hi, tMax, _CMP_LE_OQ));
+    _mm256_storeu_pd(root + h, _mm256_blendv_pd(hi, lo, loOk));
+    mask |= uint32_t(_mm256_movemask_pd(
+                _mm256_and_pd(hasRoots, _mm256_or_pd(loOk, hiOk))))
+            << h;
+  }
+  return mask;
+}
+#endif
+
+template <typename T>
+inline uint32_t packet_sphere(const Vec3<T> &center, T radius,
+                              const RayPacket<T> &p, T *root) {
+#ifdef RT_X86
+  if (packet_avx2())
+    return packet_sphere_avx2(center, radius, p, root);
+#endif
+  return packet_sphere_scalar(center, radius, p, root);
+}
+
+} // namespace detail
+
+template <typename T> class Sphere : public Hittable<T> {
+public:
+  Sphere() {}
+  Sphere(Vec3<T> cen, T r, uint32_t m) : center(cen), radius(r), matId(m){};
+
+  virtual bool hit(const Ray<T> &r, T tMin, T tMax,
+                   HitRecord<T> &rec) const override;
+
+  virtual uint32_t hit_packet(RayPacket<T> &packet, uint32_t mask,
+                              HitRecord<T> *recs) const override;
+
+  virtual bool bounding_box(AABB<T> &outputBox) const override {
+    auto r = Vec3<T>(radius, radius, radius);
+    outputBox = AABB<T>(center - r, center + r);
+    return true;
+  }
+
+  Vec3<T> center;
+  T radius;
+  uint32_t matId;
+};
+
+template <typename T>
+inline bool Sphere<T>::hit(const Ray<T> &r, T tMin, T tMax,
+                           HitRecord<T> &rec) const {
+  T root;
+  count_ray_stat(&RayStats::sphereTests);
+  if (!sphere_root(r.origin() - center, r.direction(),
+                   r.direction().length_squared(), radius, tMin, tMax, root))
+    return false;
+  count_ray_stat(&RayStats::sphereHits);
+  set_sphere_hit(r, root, center, radius, matId, rec);
   return true;
 }
 
+template <typename T>
+inline uint32_t Sphere<T>::hit_packet(RayPacket<T> &packet, uint32_t mask,
+                                      HitRecord<T> *recs) const {
+  alignas(32) T root[RayPacket<T>::size];
+  uint32_t hits = detail::packet_sphere(center, radius, packet, root) & mask;
+  count_ray_stat(&RayStats::sphereTests, __builtin_popcount(mask));
+  count_ray_stat(&RayStats::sphereHits, __builtin_popcount(hits));
+  for (uint32_t m = hits; m; m &= m - 1) {
+    int l = __builtin_ctz(m);
+    set_sphere_hit(packet.ray(l), root[l], center, radius, matId, recs[l]);
+    packet.tMax[l] = root[l];
+  }
+  return hits;
+}
+
 #endif
@@ -0,0 +1,318 @@
+#ifndef SPHERE_SOA_H
+#define SPHERE_SOA_H
+
+#include "HittableList.h"
+#include "Sphere.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RT_X86 1
+#include <immintrin.h>
+#endif
+
+/// Minimal allocator returning Alignment-aligned storage, so the SoA arrays
+/// can be read with aligned vector loads.
+template <typename T, size_t Alignment> struct AlignedAllocator {
+  using value_type = T;
+  template <typename U> struct rebind {
+    using other = AlignedAllocator<U, Alignment>;
+  };
+
+  AlignedAllocator() = default;
+  template <typename U>
+  AlignedAllocator(const AlignedAllocator<U, Alignment> &) {}
+
+  T *allocate(size_t n) {
+    return static_cast<T *>(
+        ::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+  }
+  void deallocate(T *p, size_t) {
+    ::operator delete(p, std::align_val_t(Alignment));
+  }
+
+  template <typename U>
+  bool operator==(const AlignedAllocator<U, Alignment> &) const {
+    return true;
+  }
+  template <typename U>
+  bool operator!=(const AlignedAllocator<U, Alignment> &) const {
+    return false;
+  }
+};
+
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T, 32>>;
+
+namespace detail {
+
+#ifdef RT_X86
+/// Nearest sphere hit in [tMin, closest] over the first n spheres (n a
+/// multiple of the lane count), or -1. Same arithmetic as sphere_root(),
+/// four doubles or eight floats at a time.
+__attribute__((target("avx2"))) inline long
+soa_nearest_avx2(const double *cx, const double *cy, const double *cz,
+                 const double *rad, size_t n, const Ray<double> &r,
+                 double tMin, double &closest) {
+  const auto o = r.origin();
+  const auto d = r.direction();
+  const __m256d ox = _mm256_set1_pd(o.x()), oy = _mm256_set1_pd(o.y()),
+                oz = _mm256_set1_pd(o.z());
+  const __m256d dx = _mm256_set1_pd(d.x()), dy = _mm256_set1_pd(d.y()),
+                dz = _mm256_set1_pd(d.z());
+  const __m256d a = _mm256_set1_pd(d.length_squared());
+  const __m256d lo = _mm256_set1_pd(tMin);
+  const __m256d zero = _mm256_setzero_pd();
+  const __m256d signMask = _mm256_set1_pd(-0.0);
+
+  long best = -1;
+  for (size_t i = 0; i < n; i += 4) {
+    __m256d ocx = _mm256_sub_pd(ox, _mm256_load_pd(cx + i));
+    __m256d ocy = _mm256_sub_pd(oy, _mm256_load_pd(cy + i));
+    __m256d ocz = _mm256_sub_pd(oz, _mm256_load_pd(cz + i));
+    __m256d rr = _mm256_load_pd(rad + i);
+    __m256d halfB = _mm256_add_pd(
+        _mm256_add_pd(_mm256_mul_pd(ocx, dx), _mm256_mul_pd(ocy, dy)),
+        _mm256_mul_pd(ocz, dz));
+    __m256d c = _mm256_sub_pd(
+        _mm256_add_pd(
+            _mm256_add_pd(_mm256_mul_pd(ocx, ocx), _mm256_mul_pd(ocy, ocy)),
+            _mm256_mul_pd(ocz, ocz)),
+        _mm256_mul_pd(rr, rr));
+    __m256d disc =
+        _mm256_sub_pd(_mm256_mul_pd(halfB, halfB), _mm256_mul_pd(a, c));
+    __m256d hasRoots = _mm256_cmp_pd(disc, zero, _CMP_GE_OQ);
+    if (!_mm256_movemask_pd(hasRoots))
+      continue;
+
+    __m256d sqrtd = _mm256_sqrt_pd(_mm256_max_pd(disc, zero));
+    __m256d signedSqrt =
+        _mm256_or_pd(sqrtd, _mm256_and_pd(halfB, signMask));
+    __m256d q = _mm256_sub_pd(zero, _mm256_add_pd(halfB, signedSqrt));
+    __m256d t0 = _mm256_div_pd(q, a);
+    __m256d t1 = _mm256_div_pd(c, q);
+    __m256d near = _mm256_min_pd(t0, t1);
+    __m256d far = _mm256_max_pd(t0, t1);
+
+    __m256d hi = _mm256_set1_pd(closest);
+    __m256d nearOk = _mm256_and_pd(_mm256_cmp_pd(near, lo, _CMP_GE_OQ),
+                                   _mm256_cmp_pd(near, hi, _CMP_LE_OQ));
+    __m256d farOk = _mm256_and_pd(_mm256_cmp_pd(far, lo, _CMP_GE_OQ),
+                                  _mm256_cmp_pd(far, hi, _CMP_LE_OQ));
+    nearOk = _mm256_and_pd(nearOk, hasRoots);
+    farOk = _mm256_and_pd(farOk, hasRoots);
+    int nearMask = _mm256_movemask_pd(nearOk);
+    int farMask = _mm256_movemask_pd(farOk);
+    if (!(nearMask | farMask))
+      continue;
+
+    alignas(32) double ns[4], fs[4];
+    _mm256_store_pd(ns, near);
+    _mm256_store_pd(fs, far);
+    for (int k = 0; k < 4; ++k) {
+      double t = (nearMask & (1 << k)) ? ns[k] : fs[k];
+      if (((nearMask | farMask) & (1 << k)) && t <= closest) {
+        closest = t;
+        best = i + k;
+      }
+    }
+  }
+  return best;
+}
+
+__attribute__((target("avx2"))) inline long
+soa_nearest_avx2(const float *cx, const float *cy, const float *cz,
+                 const float *rad, size_t n, const Ray<float> &r, float tMin,
+                 float &closest) {
+  const auto o = r.origin();
+  const auto d = r.direction();
+  const __m256 ox = _mm256_set1_ps(o.x()), oy = _mm256_set1_ps(o.y()),
+               oz = _mm256_set1_ps(o.z());
+  const __m256 dx = _mm256_set1_ps(d.x()), dy = _mm256_set1_ps(d.y()),
+               dz = _mm256_set1_ps(d.z());
+  const __m256 a = _mm256_set1_ps(d.length_squared());
+  const __m256 lo = _mm256_set1_ps(tMin);
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 signMask = _mm256_set1_ps(-0.0f);
+
+  long best = -1;
+  for (size_t i = 0; i < n; i += 8) {
+    __m256 ocx = _mm256_sub_ps(ox, _mm256_load_ps(cx + i));
+    __m256 ocy = _mm256_sub_ps(oy, _mm256_load_ps(cy + i));
+    __m256 ocz = _mm256_sub_ps(oz, _mm256_load_ps(cz + i));
+    __m256 rr = _mm256_load_ps(rad + i);
+    __m256 halfB = _mm256_add_ps(
+        _mm256_add_ps(_mm256_mul_ps(ocx, dx), _mm256_mul_ps(ocy, dy)),
+        _mm256_mul_ps(ocz, dz));
+    __m256 c = _mm256_sub_ps(
+        _mm256_add_ps(
+            _mm256_add_ps(_mm256_mul_ps(ocx, ocx), _mm256_mul_ps(ocy, ocy)),
+            _mm256_mul_ps(ocz, ocz)),
+        _mm256_mul_ps(rr, rr));
+    __m256 disc =
+        _mm256_sub_ps(_mm256_mul_ps(halfB, halfB), _mm256_mul_ps(a, c));
+    __m256 hasRoots = _mm256_cmp_ps(disc, zero, _CMP_GE_OQ);
+    if (!_mm256_movemask_ps(hasRoots))
+      continue;
+
+    __m256 sqrtd = _mm256_sqrt_ps(_mm256_max_ps(disc, zero));
+    __m256 signedSqrt = _mm256_or_ps(sqrtd, _mm256_and_ps(halfB, signMask));
+    __m256 q = _mm256_sub_ps(zero, _mm256_add_ps(halfB, signedSqrt));
+    __m256 t0 = _mm256_div_ps(q, a);
+    __m256 t1 = _mm256_div_ps(c, q);
+    __m256 near = _mm256_min_ps(t0, t1);
+    __m256 far = _mm256_max_ps(t0, t1);
+
+    __m256 hi = _mm256_set1_ps(closest);
+    __m256 nearOk = _mm256_and_ps(_mm256_cmp_ps(near, lo, _CMP_GE_OQ),
+                                  _mm256_cmp_ps(near, hi, _CMP_LE_OQ));
+    __m256 farOk = _mm256_and_ps(_mm256_cmp_ps(far, lo, _CMP_GE_OQ),
+                                 _mm256_cmp_ps(far, hi, _CMP_LE_OQ));
+    nearOk = _mm256_and_ps(nearOk, hasRoots);
+    farOk = _mm256_and_ps(farOk, hasRoots);
+    int nearMask = _mm256_movemask_ps(nearOk);
+    int farMask = _mm256_movemask_ps(farOk);
+    if (!(nearMask | farMask))
+      continue;
+
+    alignas(32) float ns[8], fs[8];
+    _mm256_store_ps(ns, near);
+    _mm256_store_ps(fs, far);
+    for (int k = 0; k < 8; ++k) {
+      float t = (nearMask & (1 << k)) ? ns[k] : fs[k];
+      if (((nearMask | farMask) & (1 << k)) && t <= closest) {
+        closest = t;
+        best = i + k;
+      }
+    }
+  }
+  return best;
+}
+#endif
+
+} // namespace detail
+
+/// A batch of spheres stored as structure of arrays. hit() sweeps the
+/// batch with AVX2 (picked at construction when the CPU has it), four
+/// double or eight float spheres per step, keeping only the nearest t and
+/// its index, and fills in the HitRecord once for the sphere that wins.
+/// Objects in the source list that are not spheres are kept in a
+/// HittableList and tested after.
+template <typename T> class SphereSoA : public Hittable<T> {
+public:
+  static constexpr size_t lanes = 32 / sizeof(T);
+
+  SphereSoA(const HittableList<T> &list, bool allowSimd = true);
+
+  virtual bool hit(const Ray<T> &r, T tMin, T tMax,
+                   HitRecord<T> &rec) const override;
+
+  virtual bool bounding_box(AABB<T> &outputBox) const override;
+
+  size_t size() const { return radius.size(); }
+  bool uses_avx2() const { return useAvx2; }
+
+  AlignedVector<T> centerX, centerY, centerZ;
+  AlignedVector<T> radius;
+  std::vector<uint32_t> material;
+  HittableList<T> others;
+
+private:
+  /// Return the index of the nearest sphere hit in [tMin, closest], or -1.
+  long nearest_scalar(const Ray<T> &r, T tMin, T &closest,
+                      size_t begin) const;
+
+  bool useAvx2 = false;
+};
+
+template <typename T>
+inline SphereSoA<T>::SphereSoA(const HittableList<T> &list, bool allowSimd) {
+#ifdef RT_X86
+  useAvx2 = allowSimd && __builtin_cpu_supports("avx2");
+#endif
+  for (const auto &obj : list.objects) {
+    auto sphere = std::dynamic_pointer_cast<Sphere<T>>(obj);
+    if (!sphere) {
+      others.add(obj);
+      continue;
+    }
+    centerX.push_back(sphere->center.x());
+    centerY.push_back(sphere->center.y());
+    centerZ.push_back(sphere->center.z());
+    radius.push_back(sphere->radius);
+    material.push_back(sphere->matId);
+  }
+}
+
+template <typename T>
+inline long SphereSoA<T>::nearest_scalar(const Ray<T> &r, T tMin, T &closest,
+                                         size_t begin) const {
+  const auto o = r.origin();
+  const auto d = r.direction();
+  const T a = d.length_squared();
+  long best = -1;
+  for (size_t i = begin; i < radius.size(); ++i) {
+    Vec3<T> oc(o.x() - centerX[i], o.y() - centerY[i], o.z() - centerZ[i]);
+    T root;
+    if (sphere_root(oc, d, a, radius[i], tMin, closest, root)) {
+      closest = root;
+      best = i;
+    }
+  }
+  return best;
+}
+
+template <typename T>
+inline bool SphereSoA<T>::hit(const Ray<T> &r, T tMin, T tMax,
+                              HitRecord<T> &rec) const {
+  T closest = tMax;
+  long i = -1;
+  // The vector kernels only track the nearest sphere, so each ray counts
+  // one hit at most here.
+  count_ray_stat(&RayStats::sphereTests, radius.size());
+#ifdef RT_X86
+  if (useAvx2) {
+    size_t n = radius.size() / lanes * lanes;
+    i = detail::soa_nearest_avx2(centerX.data(), centerY.data(),
+                                 centerZ.data(), radius.data(), n, r, tMin,
+                                 closest);
+    long tail = nearest_scalar(r, tMin, closest, n);
+    if (tail >= 0)
+      i = tail;
+  } else
+#endif
+    i = nearest_scalar(r, tMin, closest, 0);
+
+  bool hitAnything = i >= 0;
+  if (hitAnything) {
+    count_ray_stat(&RayStats::sphereHits);
+    Vec3<T> center(centerX[i], centerY[i], centerZ[i]);
+    set_sphere_hit(r, closest, center, radius[i], material[i], rec);
+  }
+  if (others.hit(r, tMin, closest, rec))
+    hitAnything = true;
+  return hitAnything;
+}
+
+template <typename T>
+inline bool SphereSoA<T>::bounding_box(AABB<T> &outputBox) const {
+  outputBox = AABB<T>();
+  for (size_t i = 0; i < radius.size(); ++i) {
+    Vec3<T> r(radius[i], radius[i], radius[i]);
+    Vec3<T> c(centerX[i], centerY[i], centerZ[i]);
+    outputBox.expand(AABB<T>(c - r, c + r));
+  }
+  AABB<T> box;
+  if (!others.objects.empty()) {
+    if (!others.bounding_box(box))
+      return false;
+    outputBox.expand(box);
+  }
+  return !(radius.empty() && others.objects.empty());
+}
+
+#endif /* SPHERE_SOA_H */
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+/// A rectangular block of pixels [x0, x1) x [y0, y1).
+struct Tile {
+  int x0, y0;
+  int x1, y1;
+};
+
+/// Load-balancing counters gathered by parallel_for_tiles.
+struct SchedulerStats {
+  size_t tiles = 0;  // total tiles executed
+  size_t stolen = 0; // tiles moved between workers by stealing
+  std::vector<size_t> executed; // tiles executed, per worker
+  std::vector<size_t> stolenBy; // tiles stolen, per thief
+  double stolenFraction() const { return tiles ? double(stolen) / tiles : 0; }
+
+  /// Add the counters of another run, e.g. a later render pass.
+  SchedulerStats &operator+=(const SchedulerStats &o) {
+    tiles += o.tiles;
+    stolen += o.stolen;
+    executed.resize(std::max(executed.size(), o.executed.size()));
+    stolenBy.resize(std::max(stolenBy.size(), o.stolenBy.size()));
+    for (size_t w = 0; w < o.executed.size(); ++w)
+      executed[w] += o.executed[w];
+    for (size_t w = 0; w < o.stolenBy.size(); ++w)
+      stolenBy[w] += o.stolenBy[w];
+    return *this;
+  }
+};
+
+/// Split a width x height image into tileSize x tileSize tiles (the tiles on
+/// the right and top edges may be smaller).
+std::vector<Tile> make_tiles(int width, int height, int tileSize);
+
+/// Run fn on every tile using a pool of nThreads workers, returning how the
+/// work ended up being distributed. nThreads <= 0 uses
+/// std::thread::hardware_concurrency().
+///
+/// Each worker starts with its own deque holding a contiguous run of tiles
+/// and works through it front to back. A worker whose deque runs dry steals
+/// the back half of another worker's deque, so cheap regions (sky) and
+/// expensive ones (glass) even out instead of waiting on the slowest split.
+SchedulerStats parallel_for_tiles(const std::vector<Tile> &tiles, int nThreads,
+                                  const std::function<void(const Tile &)> &fn);
+
+/// Resolve a requested thread count (<= 0 means "all hardware threads").
+int resolve_thread_count(int nThreads);
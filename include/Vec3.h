@@ -1,29 +1,38 @@
 #pragma once
 
 #include "RTWeekend.h"
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 #include <math.h>
-#include <random>
 
 using std::sqrt;
 
 /// Return a random real in [0,1)
-inline double random_dbl() {
-  static std::uniform_real_distribution<double> distribution(0.0, 1.0);
-  static std::mt19937 generator;
-  return distribution(generator);
-}
+inline double random_dbl() { return random_t<double>(); }
 
 /// Return a random real in [min, max)
 inline double random_dbl(double min, double max) {
   return min + (max - min) * random_dbl();
 }
 
+#ifdef FRT_SIMD_VEC3
+#define FRT_VEC3_LANES 4
+#else
+#define FRT_VEC3_LANES 3
+#endif
+
 template <typename T> class Vec3 {
 public:
+  /// Stored lanes; the fourth (FRT_SIMD_VEC3 only) is padding that nothing
+  /// reads. Constructors zero it, but the SIMD operations compute it along
+  /// with the others, so it can hold anything (e.g. NaN after v / 0).
+  static constexpr int lanes = FRT_VEC3_LANES;
+
   Vec3() : e{0, 0, 0} {}
   Vec3(T e0, T e1, T e2) : e{e0, e1, e2} {}
+  template <typename U>
+  explicit Vec3(const Vec3<U> &v) : e{T(v.e[0]), T(v.e[1]), T(v.e[2])} {}
 
   T x() const { return e[0]; }
   T y() const { return e[1]; }
@@ -63,17 +72,22 @@ public:
 
   /// returns true if the vector is close to zero in all dimensions
   bool near_zero() const {
-    const auto eps = 1e-8;
+    const T eps = 1e-8;
     return (fabs(e[0]) < eps) && (fabs(e[1]) < eps) && (fabs(e[2]) < eps);
   }
 
-  T e[3];
+  alignas(lanes == 4 ? 4 * sizeof(T) : alignof(T)) T e[lanes];
 };
 
 using Point3 = Vec3<double>;
 using Color = Vec3<double>;
 
 // Vec3 Utility Functions
+/// Largest absolute component
+template <typename T> inline T max_abs(const Vec3<T> &v) {
+  return std::max({std::fabs(v.e[0]), std::fabs(v.e[1]), std::fabs(v.e[2])});
+}
+
 template <typename T>
 inline std::ostream &operator<<(std::ostream &out, const Vec3<T> &v) {
   return out << v.e[0] << ' ' << v.e[1] << ' ' << v.e[2];
@@ -115,47 +129,94 @@ template <typename T> inline Vec3<T> unit_vector(Vec3<T> v) {
   return v / v.length();
 }
 
-/// Lambertian diffuse method
-template <typename T> inline Vec3<T> random_in_unit_sphere() {
-  while (1) {
-    auto p = Vec3<T>::rand(-1., 1.);
-    if (p.length_squared() >= 1)
-      continue;
-    return p;
-  }
-}
-
-template <typename T> Vec3<T> random_unit_vector() {
-  return unit_vector(random_in_unit_sphere<T>());
-}
-
-/// Uniform scatter method
-template <typename T> Vec3<T> random_in_hemisphere(const Vec3<T> &normal) {
-  Vec3<T> inUnitSphere = random_in_unit_sphere<T>();
-  if (dot(inUnitSphere, normal) < 0.0)
-    return inUnitSphere;
-  return -inUnitSphere;
-}
-
 template <typename T> Vec3<T> reflect(const Vec3<T> &v, const Vec3<T> &n) {
   return v - 2 * dot(v, n) * n;
 }
 
 /// Return the direction of the refracted vector as a vector
 template <typename T>
-Vec3<T> refract(const Vec3<T> &uv, const Vec3<T> &n, double etai_over_etat) {
-  auto cosTheta = fmin(dot(-uv, n), 1.0);
+Vec3<T> refract(const Vec3<T> &uv, const Vec3<T> &n, T etai_over_etat) {
+  auto cosTheta = std::fmin(dot(-uv, n), T(1));
   Vec3<T> outputRayPerp = etai_over_etat * (uv + cosTheta * n);
   Vec3<T> outputRayParallel =
-      -sqrt(fabs(1.0 - outputRayPerp.length_squared())) * n;
+      -sqrt(std::fabs(T(1) - outputRayPerp.length_squared())) * n;
   return outputRayPerp + outputRayParallel;
 }
 
-template <typename T> Vec3<T> random_in_unit_disk() {
-  while (1) {
-    auto p = Vec3(random_dbl(-1., 1.), random_dbl(-1., 1.), 0.0);
-    if (p.length_squared() >= 1)
-      continue;
-    return p;
-  }
-}
\ No newline at end of file
+// Sample warps. Each maps [0,1)^2 (or ^3) to its domain in closed form:
+// no rejection loop, a fixed number of inputs and no data-dependent
+// branches (the ternaries become selects), so they keep the
+// stratification of low-discrepancy samples. GCC does not vectorize loops
+// over them yet: it fuses each sin/cos pair into cexpi, which has no
+// vector form.
+
+/// Map a 2D sample to a uniform direction (z = 1 - 2u, azimuth 2 pi v).
+template <typename T> inline Vec3<T> sphere_from_square(T u, T v) {
+  T z = 1 - 2 * u;
+  T r = std::sqrt(std::max(T(0), 1 - z * z));
+  T phi = T(2 * PI) * v;
+  return Vec3<T>(r * std::cos(phi), r * std::sin(phi), z);
+}
+
+/// Map a 3D sample to a uniform point of the unit ball: a uniform direction
+/// at radius cbrt(w).
+template <typename T> inline Vec3<T> ball_from_cube(T u, T v, T w) {
+  return std::cbrt(w) * sphere_from_square(u, v);
+}
+
+/// Map a 2D sample to a uniform point of the unit disk (z = 0) with
+/// Shirley and Chiu's concentric mapping, which takes squares to rings
+/// with little distortion, so strata stay compact.
+template <typename T> inline Vec3<T> disk_from_square(T u, T v) {
+  T a = 2 * u - 1, b = 2 * v - 1;
+  bool xMajor = std::fabs(a) > std::fabs(b);
+  T r = xMajor ? a : b;
+  // r == 0 only at the centre, where any angle will do.
+  T ratio = (xMajor ? b : a) / (r != 0 ? r : T(1));
+  T phi = xMajor ? T(PI / 4) * ratio : T(PI / 2) - T(PI / 4) * ratio;
+  return Vec3<T>(r * std::cos(phi), r * std::sin(phi), 0);
+}
+
+/// Map a 2D sample to a cosine-weighted direction about the unit normal n:
+/// a concentric disk point lifted onto the hemisphere (Malley's method), in
+/// the branchless orthonormal basis of Duff et al. 2017.
+template <typename T>
+inline Vec3<T> cosine_direction(const Vec3<T> &n, T u, T v) {
+  Vec3<T> d = disk_from_square(u, v);
+  T z = std::sqrt(std::max(T(0), 1 - d.x() * d.x() - d.y() * d.y()));
+  T sign = std::copysign(T(1), n.z());
+  T a = -1 / (sign + n.z());
+  T b = n.x() * n.y() * a;
+  Vec3<T> t(1 + sign * n.x() * n.x() * a, sign * b, -sign * n.x());
+  Vec3<T> bt(b, sign + n.y() * n.y() * a, -n.y());
+  return d.x() * t + d.y() * bt + z * n;
+}
+
+// Uniform draws from the thread's random stream, each always consuming the
+// same number of values.
+
+template <typename T> inline Vec3<T> random_in_unit_sphere() {
+  T u = random_t<T>(), v = random_t<T>();
+  return ball_from_cube(u, v, random_t<T>());
+}
+
+template <typename T> inline Vec3<T> random_unit_vector() {
+  T u = random_t<T>();
+  return sphere_from_square(u, random_t<T>());
+}
+
+/// Uniform direction in the hemisphere around normal
+template <typename T>
+inline Vec3<T> random_in_hemisphere(const Vec3<T> &normal) {
+  Vec3<T> d = random_unit_vector<T>();
+  return std::copysign(T(1), dot(d, normal)) * d;
+}
+
+template <typename T> inline Vec3<T> random_in_unit_disk() {
+  T u = random_t<T>();
+  return disk_from_square(u, random_t<T>());
+}
+
+#ifdef FRT_SIMD_VEC3
+#include "Vec3Simd.h"
+#endif
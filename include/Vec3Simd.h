@@ -0,0 +1,152 @@
+#pragma once
+
+// SSE/AVX2 bodies for the hot Vec3<float> and Vec3<double> operations,
+// included at the end of Vec3.h when FRT_SIMD_VEC3 is defined. Vec3 then
+// stores four aligned lanes, so a vector is a single __m128 / __m256d load.
+//
+// Every operation keeps the scalar evaluation order (no FMA, dot sums
+// x + y then z), so images are bit-identical with and without the flag.
+
+#if !defined(__SSE4_1__) || !defined(__AVX2__)
+#error "FRT_SIMD_VEC3 needs SSE4.1 and AVX2, build with -mavx2"
+#endif
+
+#include <immintrin.h>
+
+namespace detail {
+
+inline __m128 vec3_load(const Vec3<float> &v) { return _mm_load_ps(v.e); }
+inline __m256d vec3_load(const Vec3<double> &v) { return _mm256_load_pd(v.e); }
+
+inline Vec3<float> vec3_store(__m128 x) {
+  Vec3<float> r;
+  _mm_store_ps(r.e, x);
+  return r;
+}
+inline Vec3<double> vec3_store(__m256d x) {
+  Vec3<double> r;
+  _mm256_store_pd(r.e, x);
+  return r;
+}
+
+/// (y, z, x, w)
+inline __m128 vec3_yzx(__m128 x) {
+  return _mm_shuffle_ps(x, x, _MM_SHUFFLE(3, 0, 2, 1));
+}
+inline __m256d vec3_yzx(__m256d x) {
+  return _mm256_permute4x64_pd(x, _MM_SHUFFLE(3, 0, 2, 1));
+}
+
+} // namespace detail
+
+// Members
+
+template <> inline Vec3<float> Vec3<float>::operator-() const {
+  return detail::vec3_store(
+      _mm_xor_ps(detail::vec3_load(*this), _mm_set1_ps(-0.0f)));
+}
+template <> inline Vec3<double> Vec3<double>::operator-() const {
+  return detail::vec3_store(
+      _mm256_xor_pd(detail::vec3_load(*this), _mm256_set1_pd(-0.0)));
+}
+
+template <>
+inline Vec3<float> &Vec3<float>::operator+=(const Vec3<float> &v) {
+  _mm_store_ps(e, _mm_add_ps(detail::vec3_load(*this), detail::vec3_load(v)));
+  return *this;
+}
+template <>
+inline Vec3<double> &Vec3<double>::operator+=(const Vec3<double> &v) {
+  _mm256_store_pd(
+      e, _mm256_add_pd(detail::vec3_load(*this), detail::vec3_load(v)));
+  return *this;
+}
+
+template <> inline Vec3<float> &Vec3<float>::operator*=(const float t) {
+  _mm_store_ps(e, _mm_mul_ps(detail::vec3_load(*this), _mm_set1_ps(t)));
+  return *this;
+}
+template <> inline Vec3<double> &Vec3<double>::operator*=(const double t) {
+  _mm256_store_pd(e,
+                  _mm256_mul_pd(detail::vec3_load(*this), _mm256_set1_pd(t)));
+  return *this;
+}
+
+// Free functions
+
+template <>
+inline Vec3<float> operator+(const Vec3<float> &u, const Vec3<float> &v) {
+  return detail::vec3_store(
+      _mm_add_ps(detail::vec3_load(u), detail::vec3_load(v)));
+}
+template <>
+inline Vec3<double> operator+(const Vec3<double> &u, const Vec3<double> &v) {
+  return detail::vec3_store(
+      _mm256_add_pd(detail::vec3_load(u), detail::vec3_load(v)));
+}
+
+template <>
+inline Vec3<float> operator-(const Vec3<float> &u, const Vec3<float> &v) {
+  return detail::vec3_store(
+      _mm_sub_ps(detail::vec3_load(u), detail::vec3_load(v)));
+}
+template <>
+inline Vec3<double> operator-(const Vec3<double> &u, const Vec3<double> &v) {
+  return detail::vec3_store(
+      _mm256_sub_pd(detail::vec3_load(u), detail::vec3_load(v)));
+}
+
+template <>
+inline Vec3<float> operator*(const Vec3<float> &u, const Vec3<float> &v) {
+  return detail::vec3_store(
+      _mm_mul_ps(detail::vec3_load(u), detail::vec3_load(v)));
+}
+template <>
+inline Vec3<double> operator*(const Vec3<double> &u, const Vec3<double> &v) {
+  return detail::vec3_store(
+      _mm256_mul_pd(detail::vec3_load(u), detail::vec3_load(v)));
+}
+
+template <> inline Vec3<float> operator*(float t, const Vec3<float> &v) {
+  return detail::vec3_store(_mm_mul_ps(_mm_set1_ps(t), detail::vec3_load(v)));
+}
+template <> inline Vec3<double> operator*(double t, const Vec3<double> &v) {
+  return detail::vec3_store(
+      _mm256_mul_pd(_mm256_set1_pd(t), detail::vec3_load(v)));
+}
+
+template <> inline float dot(const Vec3<float> &u, const Vec3<float> &v) {
+  // Shuffles rather than _mm_dp_ps, which has twice the latency.
+  __m128 m = _mm_mul_ps(detail::vec3_load(u), detail::vec3_load(v));
+  __m128 xy = _mm_add_ss(m, _mm_movehdup_ps(m));
+  return _mm_cvtss_f32(_mm_add_ss(xy, _mm_movehl_ps(m, m)));
+}
+template <> inline double dot(const Vec3<double> &u, const Vec3<double> &v) {
+  __m256d m = _mm256_mul_pd(detail::vec3_load(u), detail::vec3_load(v));
+  __m128d xy = _mm256_castpd256_pd128(m);
+  __m128d z = _mm256_extractf128_pd(m, 1);
+  return _mm_cvtsd_f64(_mm_add_sd(_mm_add_sd(xy, _mm_unpackhi_pd(xy, xy)), z));
+}
+
+template <>
+inline Vec3<float> cross(const Vec3<float> &u, const Vec3<float> &v) {
+  __m128 a = detail::vec3_load(u), b = detail::vec3_load(v);
+  // (z, x, y) of the cross product, rotated back into place.
+  __m128 c = _mm_sub_ps(_mm_mul_ps(a, detail::vec3_yzx(b)),
+                        _mm_mul_ps(detail::vec3_yzx(a), b));
+  return detail::vec3_store(detail::vec3_yzx(c));
+}
+template <>
+inline Vec3<double> cross(const Vec3<double> &u, const Vec3<double> &v) {
+  __m256d a = detail::vec3_load(u), b = detail::vec3_load(v);
+  __m256d c = _mm256_sub_pd(_mm256_mul_pd(a, detail::vec3_yzx(b)),
+                            _mm256_mul_pd(detail::vec3_yzx(a), b));
+  return detail::vec3_store(detail::vec3_yzx(c));
+}
+
+template <> inline float Vec3<float>::length_squared() const {
+  return dot(*this, *this);
+}
+template <> inline double Vec3<double>::length_squared() const {
+  return dot(*this, *this);
+}
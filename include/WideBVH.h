@@ -0,0 +1,345 @@
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H
+
+#include "BVH.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RT_X86 1
+#include <immintrin.h>
+#endif
+
+/// An N-ary BVH node. The children's boxes are stored as structure of
+/// arrays, so one ray is tested against all N of them with a few packed
+/// instructions. A child with count == 0 is an interior node; otherwise it
+/// is a leaf of count primitives starting at child[i]. Unused slots have
+/// empty (inverted) boxes and are never hit.
+template <int N> struct alignas(64) WideBVHNode {
+  float bounds[2][3][N]; // [min/max][axis][child]
+  uint32_t child[N];
+  uint8_t count[N];
+};
+
+/// Ray data shared by every box test of one traversal.
+struct WideRay {
+  float orig[3];
+  float invDir[3];
+  int dirIsNeg[3];
+  float slack = 0; // absolute widening of tFar, for a double origin
+};
+
+namespace detail {
+
+// Float slab tests lose a little precision against the ray. Widening tFar
+// by a few ulps keeps grazing hits (PBRT's 1 + 2 * gamma(3)).
+constexpr float wideSlabSlack = 1 + 2 * gamma<float>(3);
+
+template <int N>
+inline unsigned wide_box_test_scalar(const WideBVHNode<N> &node,
+                                     const WideRay &r, float tMin, float tMax,
+                                     float tNear[N]) {
+  unsigned mask = 0;
+  for (int i = 0; i < N; ++i) {
+    float t0 = tMin, t1 = tMax;
+    for (int a = 0; a < 3; ++a) {
+      float tn = (node.bounds[r.dirIsNeg[a]][a][i] - r.orig[a]) * r.invDir[a];
+      float tf =
+          (node.bounds[1 - r.dirIsNeg[a]][a][i] - r.orig[a]) * r.invDir[a];
+      t0 = tn > t0 ? tn : t0;
+      t1 = tf < t1 ? tf : t1;
+    }
+    tNear[i] = t0;
+    mask |= unsigned(t0 <= t1 * wideSlabSlack + r.slack) << i;
+  }
+  return mask;
+}
+
+#ifdef RT_X86
+// SSE is part of the x86-64 baseline, so BVH4 needs no runtime check.
+inline unsigned wide_box_test_sse(const WideBVHNode<4> &node,
+                                  const WideRay &r, float tMin, float tMax,
+                                  float tNear[4]) {
+  __m128 t0 = _mm_set1_ps(tMin);
+  __m128 t1 = _mm_set1_ps(tMax);
+  for (int a = 0; a < 3; ++a) {
+    __m128 o = _mm_set1_ps(r.orig[a]);
+    __m128 inv = _mm_set1_ps(r.invDir[a]);
+    __m128 tn = _mm_mul_ps(
+        _mm_sub_ps(_mm_load_ps(node.bounds[r.dirIsNeg[a]][a]), o), inv);
+    __m128 tf = _mm_mul_ps(
+        _mm_sub_ps(_mm_load_ps(node.bounds[1 - r.dirIsNeg[a]][a]), o), inv);
+    // max/min return the second operand on NaN (0 * inf), i.e. keep t0/t1.
+    t0 = _mm_max_ps(tn, t0);
+    t1 = _mm_min_ps(tf, t1);
+  }
+  _mm_storeu_ps(tNear, t0);
+  t1 = _mm_add_ps(_mm_mul_ps(t1, _mm_set1_ps(wideSlabSlack)),
+                  _mm_set1_ps(r.slack));
+  return _mm_movemask_ps(_mm_cmple_ps(t0, t1));
+}
+
+__attribute__((target("avx2"))) inline unsigned
+wide_box_test_avx2(const WideBVHNode<8> &node, const WideRay &r, float tMin,
+                   float tMax, float tNear[8]) {
+  __m256 t0 = _mm256_set1_ps(tMin);
+  __m256 t1 = _mm256_set1_ps(tMax);
+  for (int a = 0; a < 3; ++a) {
+    __m256 o = _mm256_set1_ps(r.orig[a]);
+    __m256 inv = _mm256_set1_ps(r.invDir[a]);
+    __m256 tn = _mm256_mul_ps(
+        _mm256_sub_ps(_mm256_load_ps(node.bounds[r.dirIsNeg[a]][a]), o), inv);
+    __m256 tf = _mm256_mul_ps(
+        _mm256_sub_ps(_mm256_load_ps(node.bounds[1 - r.dirIsNeg[a]][a]), o),
+        inv);
+    t0 = _mm256_max_ps(tn, t0);
+    t1 = _mm256_min_ps(tf, t1);
+  }
+  _mm256_storeu_ps(tNear, t0);
+  t1 = _mm256_add_ps(_mm256_mul_ps(t1, _mm256_set1_ps(wideSlabSlack)),
+                     _mm256_set1_ps(r.slack));
+  return _mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ));
+}
+#endif
+
+} // namespace detail
+
+/// Which box test a WideBVH uses; picked once at construction from the
+/// running CPU's features.
+enum class WideKernel { Scalar, SSE, AVX2 };
+
+inline const char *wide_kernel_name(WideKernel k) {
+  switch (k) {
+  case WideKernel::SSE:
+    return "sse";
+  case WideKernel::AVX2:
+    return "avx2";
+  default:
+    return "scalar";
+  }
+}
+
+/// A BVH with N (4 or 8) children per node, collapsed from the binary SAH
+/// hierarchy: a node keeps splitting its largest child until it has N. The
+/// tree is a quarter (BVH4) or an eighth (BVH8) as deep, and every level
+/// is one packed box test. BVH4 uses SSE and BVH8 uses AVX2 when the CPU
+/// supports it; both fall back to a scalar loop elsewhere.
+template <int N, typename T> class WideBVH : public Hittable<T> {
+  static_assert(N == 4 || N == 8, "WideBVH supports 4 or 8 children");
+
+public:
+  static constexpr size_t maxLeafSize = 4;
+
+  WideBVH(const HittableList<T> &list, bool allowSimd = true);
+
+  virtual bool hit(const Ray<T> &r, T tMin, T tMax,
+                   HitRecord<T> &rec) const override;
+
+  virtual bool bounding_box(AABB<T> &outputBox) const override {
+    outputBox = bounds;
+    return !nodes.empty();
+  }
+
+  WideKernel kernel() const { return kern; }
+
+  std::vector<WideBVHNode<N>> nodes;
+  std::vector<const Hittable<T> *> primitives;
+
+private:
+  struct Range {
+    size_t begin, end;
+    AABB<T> box;
+  };
+
+  uint32_t build(std::vector<BVHPrimitive<T>> &prims, size_t begin,
+                 size_t end);
+
+  template <typename BoxTest>
+  bool traverse(const Ray<T> &r, T tMin, T tMax, HitRecord<T> &rec,
+                BoxTest boxTest) const;
+
+  AABB<T> bounds;
+  WideKernel kern = WideKernel::Scalar;
+  std::vector<std::shared_ptr<Hittable<T>>> owned;
+};
+
+template <typename T> using BVH4 = WideBVH<4, T>;
+template <typename T> using BVH8 = WideBVH<8, T>;
+
+template <int N, typename T>
+WideBVH<N, T>::WideBVH(const HittableList<T> &list, bool allowSimd) {
+#ifdef RT_X86
+  if (allowSimd && N == 4)
+    kern = WideKernel::SSE;
+  if (allowSimd && N == 8 && __builtin_cpu_supports("avx2"))
+    kern = WideKernel::AVX2;
+#endif
+
+  auto prims = make_bvh_primitives(list);
+  if (prims.empty())
+    return;
+  for (const auto &p : prims)
+    bounds.expand(p.box);
+  build(prims, 0, prims.size());
+  for (const auto &p : prims)
+    owned.push_back(p.object);
+}
+
+template <int N, typename T>
+uint32_t WideBVH<N, T>::build(std::vector<BVHPrimitive<T>> &prims,
+                              size_t begin, size_t end) {
+  auto range_box = [&](size_t b, size_t e) {
+    AABB<T> box;
+    for (size_t i = b; i < e; ++i)
+      box.expand(prims[i].box);
+    return box;
+  };
+
+  // Open up the binary hierarchy: split the largest splittable child until
+  // the node is full.
+  std::vector<Range> children{{begin, end, range_box(begin, end)}};
+  while (children.size() < size_t(N)) {
+    int best = -1;
+    for (size_t c = 0; c < children.size(); ++c) {
+      if (children[c].end - children[c].begin <= maxLeafSize)
+        continue;
+      if (best < 0 ||
+          children[c].box.surface_area() > children[best].box.surface_area())
+        best = c;
+    }
+    if (best < 0)
+      break;
+    Range r = children[best];
+    size_t mid = sah_partition(prims, r.begin, r.end);
+    children[best] = {r.begin, mid, range_box(r.begin, mid)};
+    children.push_back({mid, r.end, range_box(mid, r.end)});
+  }
+
+  uint32_t index = nodes.size();
+  nodes.emplace_back();
+  for (int i = 0; i < N; ++i) {
+    for (int a = 0; a < 3; ++a) {
+      nodes[index].bounds[0][a][i] = INFINITY;
+      nodes[index].bounds[1][a][i] = -INFINITY;
+    }
+    nodes[index].child[i] = 0;
+    nodes[index].count[i] = 0;
+  }
+
+  for (size_t c = 0; c < children.size(); ++c) {
+    const auto &ch = children[c];
+    for (int a = 0; a < 3; ++a) {
+      nodes[index].bounds[0][a][c] =
+          std::nextafter(float(ch.box.minimum[a]), -INFINITY);
+      nodes[index].bounds[1][a][c] =
+          std::nextafter(float(ch.box.maximum[a]), INFINITY);
+    }
+    if (ch.end - ch.begin <= maxLeafSize) {
+      nodes[index].child[c] = primitives.size();
+      nodes[index].count[c] = ch.end - ch.begin;
+      for (size_t i = ch.begin; i < ch.end; ++i)
+        primitives.push_back(prims[i].object.get());
+    } else {
+      // build() may grow nodes, so never hold a reference across it.
+      uint32_t childIndex = build(prims, ch.begin, ch.end);
+      nodes[index].child[c] = childIndex;
+    }
+  }
+  return index;
+}
+
+template <int N, typename T>
+template <typename BoxTest>
+bool WideBVH<N, T>::traverse(const Ray<T> &r, T tMin, T tMax,
+                             HitRecord<T> &rec, BoxTest boxTest) const {
+  if (nodes.empty())
+    return false;
+
+  WideRay wr;
+  for (int a = 0; a < 3; ++a) {
+    wr.orig[a] = r.origin()[a];
+    wr.invDir[a] = 1.0f / float(r.direction()[a]);
+    wr.dirIsNeg[a] = wr.invDir[a] < 0;
+  }
+  // Rounding a double origin to float shifts each slab by up to that error
+  // times |invDir|, however far along the ray it is, so the relative slack
+  // does not cover it. Either end of the interval may move, hence twice
+  // the largest shift. An axis the ray runs parallel to (infinite invDir)
+  // is left out; its slab test was exact only up to float precision anyway.
+  float shift = 0;
+  for (int a = 0; a < 3; ++a) {
+    double err = std::fabs(double(r.origin()[a]) - double(wr.orig[a]));
+    float axisShift = float(err * std::fabs(wr.invDir[a]));
+    if (std::isfinite(axisShift))
+      shift = std::max(shift, axisShift);
+  }
+  wr.slack = 2 * shift * detail::wideSlabSlack;
+
+  struct Entry {
+    uint32_t child;
+    uint32_t count; // 0 for interior nodes
+    float tNear;
+  };
+  Entry stack[N * 32];
+  int toVisit = 0;
+  stack[toVisit++] = {0, 0, float(tMin)};
+
+  bool hitAnything = false;
+  auto closestSoFar = tMax;
+  alignas(32) float tNear[N];
+  while (toVisit > 0) {
+    Entry e = stack[--toVisit];
+    if (e.tNear > closestSoFar * detail::wideSlabSlack + wr.slack)
+      continue;
+
+    if (e.count > 0) {
+      for (uint32_t i = 0; i < e.count; ++i) {
+        if (primitives[e.child + i]->hit(r, tMin, closestSoFar, rec)) {
+          hitAnything = true;
+          closestSoFar = rec.t;
+        }
+      }
+      continue;
+    }
+
+    const auto &node = nodes[e.child];
+    count_ray_stat(&RayStats::nodeVisits);
+    unsigned mask = boxTest(node, wr, float(tMin), float(closestSoFar), tNear);
+
+    // Push the hit children far to near so the nearest is popped first.
+    int first = toVisit;
+    for (int i = 0; i < N; ++i) {
+      if (!(mask & (1u << i)))
+        continue;
+      Entry ce{node.child[i], node.count[i], tNear[i]};
+      int k = toVisit++;
+      while (k > first && stack[k - 1].tNear < ce.tNear) {
+        stack[k] = stack[k - 1];
+        --k;
+      }
+      stack[k] = ce;
+    }
+  }
+  return hitAnything;
+}
+
+template <int N, typename T>
+bool WideBVH<N, T>::hit(const Ray<T> &r, T tMin, T tMax,
+                        HitRecord<T> &rec) const {
+#ifdef RT_X86
+  if constexpr (N == 4) {
+    if (kern == WideKernel::SSE)
+      return traverse(r, tMin, tMax, rec, detail::wide_box_test_sse);
+  } else {
+    if (kern == WideKernel::AVX2)
+      return traverse(r, tMin, tMax, rec, detail::wide_box_test_avx2);
+  }
+#endif
+  return traverse(r, tMin, tMax, rec, detail::wide_box_test_scalar<N>);
+}
+
+#endif /* WIDE_BVH_H */
@@ -0,0 +1,211 @@
+#include "Checkpoint.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <utility>
+
+namespace {
+
+const char magic[8] = {'F', 'R', 'T', 'C', 'K', 'P', 'T', '1'};
+// Render settings are one short line; anything longer is not ours.
+constexpr uint32_t maxSettingsSize = 4096;
+
+template <typename V> void put(std::ostream &out, V v) {
+  out.write(reinterpret_cast<const char *>(&v), sizeof(v));
+}
+
+template <typename V> void append(std::string &buf, V v) {
+  buf.append(reinterpret_cast<const char *>(&v), sizeof(v));
+}
+
+template <typename V> bool get(std::istream &in, V &v) {
+  return bool(in.read(reinterpret_cast<char *>(&v), sizeof(v)));
+}
+
+/// One pixel as stored in a checkpoint row.
+struct PixelRecord {
+  double sum[3];
+  int32_t count, target;
+  PixelVariance variance;
+};
+
+void append_pixel(std::string &buf, const PixelRecord &r, bool withVariance) {
+  for (double c : r.sum)
+    append(buf, c);
+  append(buf, r.count);
+  append(buf, r.target);
+  if (withVariance) {
+    append(buf, int32_t(r.variance.n));
+    append(buf, r.variance.mean);
+    append(buf, r.variance.m2);
+  }
+}
+
+bool get_pixel(std::istream &in, PixelRecord &r, bool withVariance) {
+  for (double &c : r.sum)
+    if (!get(in, c))
+      return false;
+  if (!get(in, r.count) || !get(in, r.target))
+    return false;
+  if (withVariance) {
+    int32_t n;
+    if (!get(in, n) || !get(in, r.variance.mean) || !get(in, r.variance.m2))
+      return false;
+    r.variance.n = n;
+  }
+  return true;
+}
+
+} // namespace
+
+CheckpointWriter::CheckpointWriter(const Image &img, std::string path,
+                                   double interval)
+    : path(std::move(path)), interval(interval), width(img.width),
+      height(img.height), settings(img.renderSettings) {
+  snapshot.pass = img.pass;
+  snapshot.data = img.data;
+  snapshot.sampleCount = img.sampleCount;
+  snapshot.sampleTarget = img.sampleTarget;
+  snapshot.variance = img.variance;
+  thread = std::thread([this] { run(); });
+}
+
+CheckpointWriter::~CheckpointWriter() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stop = true;
+  }
+  wake.notify_one();
+  thread.join();
+}
+
+void CheckpointWriter::start_pass(const Image &img, int pass) {
+  std::lock_guard<std::mutex> writing(passMutex);
+  std::lock_guard<std::mutex> lock(mutex);
+  snapshot.pass = pass;
+  snapshot.sampleTarget = img.sampleTarget;
+}
+
+void CheckpointWriter::tile_done(const Image &img, const Tile &tile) {
+  std::lock_guard<std::mutex> lock(mutex);
+  for (int j = tile.y0; j < tile.y1; ++j) {
+    for (int i = tile.x0; i < tile.x1; ++i) {
+      int p = i + j * width;
+      snapshot.data[p] = img.data[p];
+      snapshot.sampleCount[p] = img.sampleCount[p];
+      if (!snapshot.variance.empty())
+        snapshot.variance[p] = img.variance[p];
+    }
+  }
+}
+
+void CheckpointWriter::run() {
+  std::unique_lock<std::mutex> lock(mutex);
+  auto period = std::chrono::duration<double>(interval);
+  while (!wake.wait_for(lock, period, [this] { return stop; })) {
+    lock.unlock();
+    write();
+    lock.lock();
+  }
+}
+
+void CheckpointWriter::write() {
+  // Holding passMutex keeps the pass number and sample targets fixed for
+  // the whole write, while tiles keep finishing: the snapshot is copied a
+  // row at a time, so tile_done never waits for more than one row.
+  std::lock_guard<std::mutex> writing(passMutex);
+  std::string tmp = path + ".tmp";
+  std::ofstream out(tmp, std::ios::binary);
+  bool withVariance;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    out.write(magic, sizeof(magic));
+    put(out, int32_t(width));
+    put(out, int32_t(height));
+    put(out, int32_t(snapshot.pass));
+    withVariance = !snapshot.variance.empty();
+    put(out, int32_t(withVariance));
+    put(out, uint32_t(settings.size()));
+    out.write(settings.data(), settings.size());
+  }
+
+  std::vector<PixelRecord> row(width);
+  std::string buf;
+  for (int j = 0; j < height; ++j) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (int i = 0; i < width; ++i) {
+        int p = i + j * width;
+        PixelRecord &r = row[i];
+        for (int c = 0; c < 3; ++c)
+          r.sum[c] = snapshot.data[p][c];
+        r.count = snapshot.sampleCount[p];
+        r.target = snapshot.sampleTarget[p];
+        if (withVariance)
+          r.variance = snapshot.variance[p];
+      }
+    }
+    // One stream write per row; per-value writes cost more than the
+    // copying.
+    buf.clear();
+    for (const auto &r : row)
+      append_pixel(buf, r, withVariance);
+    out.write(buf.data(), buf.size());
+  }
+  out.close();
+  if (!out || std::rename(tmp.c_str(), path.c_str()) != 0)
+    std::cerr << "\nCould not write checkpoint " << path << '\n';
+}
+
+bool load_checkpoint(const std::string &path, Image &img) {
+  std::ifstream in(path, std::ios::binary);
+  char fileMagic[sizeof(magic)];
+  int32_t width, height, pass, withVariance;
+  uint32_t settingsSize;
+  if (!in.read(fileMagic, sizeof(fileMagic)) ||
+      std::memcmp(fileMagic, magic, sizeof(magic)) != 0 ||
+      !get(in, width) || !get(in, height) || !get(in, pass) ||
+      !get(in, withVariance) || !get(in, settingsSize) ||
+      settingsSize > maxSettingsSize) {
+    std::cerr << path << " is not a checkpoint\n";
+    return false;
+  }
+  std::string settings(settingsSize, '\0');
+  if (!in.read(&settings[0], settingsSize)) {
+    std::cerr << "Checkpoint " << path << " is truncated\n";
+    return false;
+  }
+  if (width != img.width || height != img.height ||
+      settings != img.renderSettings) {
+    std::cerr << "Checkpoint " << path << " was written for " << width
+              << " x " << height << " with settings \"" << settings
+              << "\", not " << img.width << " x " << img.height
+              << " with \"" << img.renderSettings << "\"\n";
+    return false;
+  }
+
+  const size_t n = size_t(width) * height;
+  img.data.assign(n, Color(0, 0, 0));
+  img.sampleCount.assign(n, 0);
+  img.sampleTarget.assign(n, 0);
+  img.variance.assign(withVariance ? n : 0, PixelVariance());
+  PixelRecord r;
+  for (size_t p = 0; p < n; ++p) {
+    if (!get_pixel(in, r, withVariance)) {
+      std::cerr << "Checkpoint " << path << " is truncated\n";
+      return false;
+    }
+    img.data[p] = Color(r.sum[0], r.sum[1], r.sum[2]);
+    img.sampleCount[p] = r.count;
+    img.sampleTarget[p] = r.target;
+    if (withVariance)
+      img.variance[p] = r.variance;
+  }
+  img.pass = pass;
+  img.resumed = true;
+  return true;
+}
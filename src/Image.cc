@@ -1,50 +1,423 @@
 #include "Image.h"
-#include "Material.h"
+#include "Checkpoint.h"
+#include "ImageWriter.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
 
-Color Image::ray_color(const Ray<double> &r, const Hittable &world, int depth) {
-  HitRecord rec;
+template <typename T>
+Vec3<T> Image::ray_color(const Ray<T> &r, const Hittable<T> &world,
+                         const MaterialTable<T> &materials, int maxDepth) {
+  HitRecord<T> rec;
+  bool hit = world.hit(r, 0, INF, rec);
+  return trace_path(r, hit, rec, world, materials, maxDepth);
+}
+
+template <typename T>
+Vec3<T> Image::trace_path(const Ray<T> &r, bool hit, const HitRecord<T> &hitRec,
+                          const Hittable<T> &world,
+                          const MaterialTable<T> &materials, int maxDepth) {
+  Vec3<T> throughput(1, 1, 1);
+  Ray<T> ray = r;
+  HitRecord<T> rec = hitRec;
+
+  // Walk the path iteratively, multiplying the attenuation of every bounce
+  // into throughput. Once the bounce limit is exceeded, no more light is
+  // gathered.
+  for (int bounce = 0; bounce < maxDepth; ++bounce) {
+    thread_rng().start_bounce(bounce);
+    ++thread_work().rays;
+    count_ray_stat(bounce == 0 ? &RayStats::primaryRays
+                               : &RayStats::secondaryRays);
+
+    // Scattered rays start off the surface (see spawn_ray), so no epsilon
+    // is needed on tMin.
+    if (bounce > 0)
+      hit = world.hit(ray, 0, INF, rec);
+    if (!hit) {
+      count_path_end(PathEnd::Escaped, bounce);
+      return throughput * background(ray);
+    }
+
+    Ray<T> scattered;
+    Vec3<T> attenuation;
+    if (!scatter(materials[rec.matId], ray, rec, attenuation, scattered)) {
+      count_path_end(PathEnd::Absorbed, bounce);
+      return Vec3<T>(0, 0, 0);
+    }
+    throughput = throughput * attenuation;
+    if (!survive_roulette(throughput, bounce)) {
+      count_path_end(PathEnd::Roulette, bounce);
+      return Vec3<T>(0, 0, 0);
+    }
+    ray = scattered;
+  }
+  count_path_end(PathEnd::DepthLimit, maxDepth);
+  return Vec3<T>(0, 0, 0);
+}
+
+template <typename T>
+void Image::render_tile(const Tile &tile, const Camera<T> &cam,
+                        const Hittable<T> &world,
+                        const MaterialTable<T> &materials, int maxDepth) {
+  if (packets) {
+    render_tile_packets(tile, cam, world, materials, maxDepth);
+    return;
+  }
+  for (int j = tile.y0; j < tile.y1; ++j) {
+    for (int i = tile.x0; i < tile.x1; ++i) {
+      int p = i + j * width;
+      for (int s = sampleCount[slot(p)]; s < sampleTarget[slot(p)]; ++s) {
+        // Keying the RNG on (pixel, sample) keeps the output independent of
+        // the thread count, tile order and pass structure.
+        thread_rng().start_path(seed, p, s, sampler.get());
+        T du, dv;
+        sample_2d(PixelDim, du, dv);
+        T u = (i + du) / (width - 1);
+        T v = (j + dv) / (height - 1);
+        Ray<T> r = cam.getRay(u, v);
+        add_sample(p, Color(ray_color(r, world, materials, maxDepth)));
+      }
+    }
+  }
+}
+
+template <typename T>
+void Image::render_tile_packets(const Tile &tile, const Camera<T> &cam,
+                                const Hittable<T> &world,
+                                const MaterialTable<T> &materials,
+                                int maxDepth) {
+  // Camera rays of a 4x2 pixel block travel in one packet; a block that
+  // sticks out of the tile just leaves the outside lanes inactive.
+  constexpr int N = RayPacket<T>::size;
+  constexpr int blockW = 4, blockH = N / blockW;
+  RayPacket<T> packet;
+  HitRecord<T> recs[N];
+  for (int j0 = tile.y0; j0 < tile.y1; j0 += blockH) {
+    for (int i0 = tile.x0; i0 < tile.x1; i0 += blockW) {
+      int pixel[N];
+      for (int l = 0; l < N; ++l) {
+        int i = i0 + l % blockW, j = j0 + l / blockW;
+        pixel[l] = i < tile.x1 && j < tile.y1 ? i + j * width : -1;
+      }
+
+      while (true) {
+        // A lane drops out once its pixel has reached its sample target.
+        uint32_t active = 0;
+        for (int l = 0; l < N; ++l)
+          if (pixel[l] >= 0 &&
+              sampleCount[slot(pixel[l])] < sampleTarget[slot(pixel[l])])
+            active |= 1u << l;
+        if (active == 0)
+          break;
 
-  // If we have exceeded the ray bounce limit, no more light should be gathered.
-  if (depth <= 0)
-    return Color(0, 0, 0);
+        // Generate the camera rays exactly as the single ray path does.
+        for (int l = 0; l < N; ++l) {
+          if (!(active >> l & 1))
+            continue;
+          int i = i0 + l % blockW, j = j0 + l / blockW;
+          thread_rng().start_path(seed, pixel[l],
+                                   sampleCount[slot(pixel[l])], sampler.get());
+          T du, dv;
+          sample_2d(PixelDim, du, dv);
+          T u = (i + du) / (width - 1);
+          T v = (j + dv) / (height - 1);
+          packet.set(l, cam.getRay(u, v));
+        }
 
-  if (world.hit(r, 0.001, INF, rec)) {
-    Ray<double> scattered;
-    Color attenuation;
-    if (rec.matPtr->scatter(r, rec, attenuation, scattered))
-      return attenuation * ray_color(scattered, world, depth - 1);
-    return Color(0, 0, 0);
+        uint32_t hits = world.hit_packet(packet, active, recs);
+
+        // The rest of each path is incoherent, so it is traced on its own.
+        // start_path rewinds the lane's random stream, which keeps the
+        // image identical to the single ray path.
+        for (int l = 0; l < N; ++l) {
+          if (!(active >> l & 1))
+            continue;
+          thread_rng().start_path(seed, pixel[l],
+                                   sampleCount[slot(pixel[l])], sampler.get());
+          add_sample(pixel[l],
+                     Color(trace_path(packet.ray(l), bool(hits >> l & 1),
+                                      recs[l], world, materials, maxDepth)));
+        }
+      }
+    }
   }
-  Vec3<double> unit_direction = unit_vector(r.direction());
-  auto t = 0.5 * (unit_direction.y() + 1.0);
-  return (1.0 - t) * Color(1.0, 1.0, 1.0) + t * Color(0.5, 0.7, 1.0);
 }
 
-void Image::render(Camera &cam, HittableList &world, int maxDepth) {
-  data.resize(height * width);
-  for (int j = height - 1; j >= 0; --j) {
+bool Image::plan_progressive_pass() {
+  const int cap = timeBudget > 0 ? sampleCap : samplesPerPixel;
+  bool more = false;
+  for (size_t p = 0; p < data.size(); ++p) {
+    if (sampleCount[p] < cap) {
+      sampleTarget[p] = sampleCount[p] + 1;
+      more = true;
+    }
+  }
+  return more;
+}
+
+bool Image::plan_adaptive_pass() {
+  // A pixel's own variance estimate is unreliable when its few samples
+  // happened to miss a rare bright path (it then looks converged and the
+  // image is biased dark), so a pixel only counts as converged when its
+  // whole 3x3 neighbourhood is.
+  std::vector<float> error(data.size());
+  for (size_t p = 0; p < data.size(); ++p)
+    error[p] = variance[p].display_error();
+
+  // Rows are those of the band in the buffers.
+  const int rows = int(data.size()) / width;
+  bool more = false;
+  for (int j = 0; j < rows; ++j) {
     for (int i = 0; i < width; ++i) {
-      std::cerr << "\rScanlines remaining: " << j << ' ' << std::flush;
-      for (int s = 0; s < samplesPerPixel; ++s) {
-        auto u = (i + random_t<double>()) / (width - 1);
-        auto v = (j + random_t<double>()) / (height - 1);
-        Ray<double> r = cam.getRay(u, v);
-        data[i + j * width] += ray_color(r, world, maxDepth);
+      int p = i + j * width;
+      if (sampleCount[p] >= sampleCap)
+        continue;
+      float worst = 0;
+      for (int y = std::max(j - 1, 0); y <= std::min(j + 1, rows - 1); ++y)
+        for (int x = std::max(i - 1, 0); x <= std::min(i + 1, width - 1); ++x)
+          worst = std::max(worst, error[x + y * width]);
+      if (worst > noiseThreshold) {
+        sampleTarget[p] =
+            std::min(sampleCap, sampleCount[p] + adaptiveBatch);
+        more = true;
       }
     }
   }
+  return more;
+}
+
+int Image::band_rows() const {
+  size_t pixelBytes = sizeof(Color) + 2 * sizeof(int);
+  if (noiseThreshold > 0)
+    pixelBytes += sizeof(PixelVariance);
+  const int rows = std::max(tileSize, 1);
+  size_t tileRows = streamMemory / (pixelBytes * width * rows);
+  return int(std::max<size_t>(tileRows, 1)) * rows;
+}
+
+template <typename T>
+void Image::render(const Camera<T> &cam, const Hittable<T> &world,
+                   const MaterialTable<T> &materials, int maxDepth) {
+  using Clock = std::chrono::steady_clock;
+  const bool adaptive = noiseThreshold > 0;
+  const bool progressive = adaptive || timeBudget > 0;
+  const int bandRows = stream ? std::min(band_rows(), height) : height;
+  if (stream)
+    std::cerr << "Streaming " << (height + bandRows - 1) / bandRows
+              << " bands of up to " << bandRows << " rows\n";
+
+  // Only a fixed sample count says in advance how much work is left.
+  uint64_t work = 0;
+  if (!progressive && resumed)
+    for (size_t p = 0; p < sampleCount.size(); ++p)
+      work += sampleTarget[p] - sampleCount[p];
+  else if (!progressive)
+    work = uint64_t(width) * height * samplesPerPixel;
+  auto progress = std::make_unique<Progress>(progressStyle, work, timeBudget);
+
+  SchedulerStats stats;
+  WavefrontStats waveStats;
+  const auto start = Clock::now();
+  int passes = 0;
+  double totalSamples = 0;
+  for (int y0 = 0; y0 < height; y0 += bandRows) {
+    const int y1 = std::min(y0 + bandRows, height);
+    // A resumed render continues the loaded pass with the loaded targets.
+    const int firstPassIndex = resumed ? pass : 0;
+    if (!resumed) {
+      const size_t n = size_t(y1 - y0) * width;
+      firstRow = y0;
+      data.assign(n, Color(0, 0, 0));
+      sampleCount.assign(n, 0);
+      variance.assign(adaptive ? n : 0, PixelVariance());
+      // Adaptive sampling starts with minSamples everywhere and then runs
+      // passes of adaptiveBatch samples over the pixels that are still
+      // noisy. Under a time budget alone, every pass adds one sample to
+      // every pixel.
+      int firstPass = adaptive          ? std::min(minSamples, sampleCap)
+                      : timeBudget > 0 ? 1
+                                        : samplesPerPixel;
+      sampleTarget.assign(n, firstPass);
+      pass = 0;
+    }
+    render_band(y0, y1, cam, world, materials, maxDepth, *progress, stats,
+                waveStats);
+    passes += pass + 1 - firstPassIndex;
+    for (int n : sampleCount)
+      totalSamples += n;
+  }
+  raysTraced = progress->rays_traced();
+  progress.reset(); // prints the final report
+  schedulerStats = stats;
+  if (wavefront)
+    print_wavefront_stats(waveStats, sortRays);
+  if (progressive) {
+    double mean = totalSamples / (double(width) * height);
+    double seconds =
+        std::chrono::duration<double>(Clock::now() - start).count();
+    std::cerr << (adaptive ? "Adaptive sampling: " : "Progressive: ") << mean
+              << " spp on average";
+    if (sampleCap != noSampleCap)
+      std::cerr << " (" << 100 * mean / sampleCap << "% of " << sampleCap
+                << ')';
+    std::cerr << " in " << passes << " passes, " << seconds << " s\n";
+  }
+}
+
+template <typename T>
+void Image::render_band(int y0, int y1, const Camera<T> &cam,
+                        const Hittable<T> &world,
+                        const MaterialTable<T> &materials, int maxDepth,
+                        Progress &progress, SchedulerStats &stats,
+                        WavefrontStats &waveStats) {
+  using Clock = std::chrono::steady_clock;
+  const bool adaptive = noiseThreshold > 0;
+  const bool progressive = adaptive || timeBudget > 0;
+  auto allTiles = make_tiles(width, y1 - y0, tileSize);
+  for (auto &tile : allTiles) {
+    tile.y0 += y0;
+    tile.y1 += y0;
+  }
+  std::unique_ptr<CheckpointWriter> checkpoint;
+  if (!checkpointFile.empty())
+    checkpoint = std::make_unique<CheckpointWriter>(*this, checkpointFile,
+                                                    checkpointInterval);
+
+  // A render of one fixed-size pass finishes each strip of tiles for good,
+  // so a strip is written as soon as its last tile is done. Multi-pass
+  // renders write the band after the last pass.
+  const int stripRows = std::max(tileSize, 1);
+  const int tilesPerStrip = (width + stripRows - 1) / stripRows;
+  std::vector<std::atomic<int>> stripTiles(
+      stream && !progressive ? (y1 - y0 + stripRows - 1) / stripRows : 0);
+
+  std::mutex statsMutex;
+  const auto start = Clock::now();
+  for (;; ++pass) {
+    const auto passStart = Clock::now();
+    if (checkpoint)
+      checkpoint->start_pass(*this, pass);
+    if (progressive)
+      progress.set_pass(pass);
+    std::vector<Tile> tiles;
+    for (const auto &tile : allTiles) {
+      bool work = false;
+      for (int j = tile.y0; j < tile.y1 && !work; ++j)
+        for (int i = tile.x0; i < tile.x1 && !work; ++i)
+          work = sampleCount[slot(i + j * width)] <
+                 sampleTarget[slot(i + j * width)];
+      if (work)
+        tiles.push_back(tile);
+    }
+
+    stats += parallel_for_tiles(tiles, threads, [&](const Tile &tile) {
+      WavefrontStats tileStats;
+      if (wavefront)
+        render_tile_wavefront(tile, cam, world, materials, maxDepth,
+                              tileStats);
+      else
+        render_tile(tile, cam, world, materials, maxDepth);
+      if (checkpoint)
+        checkpoint->tile_done(*this, tile);
+      if (!stripTiles.empty() &&
+          ++stripTiles[(tile.y0 - y0) / stripRows] == tilesPerStrip)
+        stream->write_rows(*this, tile.y0, tile.y1);
+      progress.add_thread_work();
+      if (wavefront) {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        waveStats += tileStats;
+      }
+    });
+
+    // Stop before a pass that would overrun the budget, assuming it takes
+    // as long as the one just finished.
+    if (timeBudget > 0) {
+      auto now = Clock::now();
+      double elapsed = std::chrono::duration<double>(now - start).count();
+      double last = std::chrono::duration<double>(now - passStart).count();
+      if (elapsed + last > timeBudget)
+        break;
+    }
+    if (adaptive ? !plan_adaptive_pass() : !plan_progressive_pass())
+      break;
+  }
+  if (stream && progressive)
+    stream->write_rows(*this, y0, y1);
+}
+
+template void Image::render(const Camera<float> &, const Hittable<float> &,
+                            const MaterialTable<float> &, int);
+template void Image::render(const Camera<double> &, const Hittable<double> &,
+                            const MaterialTable<double> &, int);
+
+void print_scheduler_stats(const SchedulerStats &stats) {
+  std::cerr << "\nTiles stolen: " << stats.stolen << " of " << stats.tiles
+            << " (" << 100.0 * stats.stolenFraction() << "%)\n";
+  for (size_t w = 0; w < stats.executed.size(); ++w)
+    std::cerr << "  worker " << w << ": " << stats.executed[w]
+              << " tiles, " << stats.stolenBy[w] << " stolen\n";
+}
+
+void print_wavefront_stats(const WavefrontStats &stats, bool sorted) {
+  std::cerr << "Wavefront secondary rays (" << (sorted ? "sorted" : "unsorted")
+            << "): " << stats.rays << " in " << stats.intersectSeconds
+            << " s of intersection, "
+            << (stats.intersectSeconds > 0
+                    ? stats.rays / stats.intersectSeconds * 1e-6
+                    : 0)
+            << " Mrays/s\n";
+  std::cerr << "  coherent packets: " << stats.coherentPackets << " of "
+            << stats.packets << '\n';
+  if (sorted)
+    std::cerr << "  sorting: " << stats.sortSeconds << " s\n";
+  if (stats.cacheMissesCounted)
+    std::cerr << "  cache misses: " << stats.cacheMisses << " ("
+              << (stats.rays ? double(stats.cacheMisses) / stats.rays : 0)
+              << " per ray)\n";
+  else
+    std::cerr << "  cache misses: not available (perf_event_open failed)\n";
 }
 
 void Image::printInfo() {
   std::cerr << "Resolution: " << width << " x " << height << '\n';
-  std::cerr << "Samples per pixel: " << samplesPerPixel << '\n';
+  if (noiseThreshold <= 0 && timeBudget <= 0)
+    std::cerr << "Samples per pixel: " << samplesPerPixel << '\n';
+  else if (sampleCap != noSampleCap)
+    std::cerr << "Samples per pixel: at most " << sampleCap << '\n';
+  else
+    std::cerr << "Samples per pixel: no cap\n";
+  if (noiseThreshold > 0)
+    std::cerr << "Noise threshold: " << noiseThreshold << " (at least "
+              << minSamples << " spp)\n";
+  if (timeBudget > 0)
+    std::cerr << "Time budget: " << timeBudget << " s\n";
   std::cerr << "Aspect ratio: " << aspectRatio << '\n';
+  std::cerr << "Threads: " << resolve_thread_count(threads) << '\n';
 }
 
 std::ostream &operator<<(std::ostream &out, const Image &img) {
   out << "P3\n" << img.width << ' ' << img.height << "\n255\n";
-  for (int j = img.height - 1; j >= 0; --j)
-    for (int i = 0; i < img.width; ++i)
-      write_color(out, img.data[i + j * img.width], img.samplesPerPixel);
+  for (int j = img.height - 1; j >= 0; --j) {
+    for (int i = 0; i < img.width; ++i) {
+      int p = i + j * img.width;
+      write_color(out, img.data[p], std::max(img.sampleCount[p], 1));
+    }
+  }
   return out;
 }
+
+void write_sample_map(std::ostream &out, const Image &img) {
+  int most = 1;
+  for (int n : img.sampleCount)
+    most = std::max(most, n);
+  out << "P3\n" << img.width << ' ' << img.height << "\n255\n";
+  for (int j = img.height - 1; j >= 0; --j) {
+    for (int i = 0; i < img.width; ++i) {
+      int n = img.sampleCount[i + j * img.width];
+      int v = int(255 * int64_t(n) / most);
+      out << v << ' ' << v << ' ' << v << '\n';
+    }
+  }
+}
@@ -0,0 +1,600 @@
+#include "ImageWriter.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <queue>
+#include <utility>
+#include <vector>
+
+#ifdef __unix__
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#define IMAGE_WRITER_POSIX 1
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define IMAGE_WRITER_X86 1
+#endif
+
+namespace {
+
+/// Gamma-2 quantization of one channel, as write_color does it, except
+/// that NaN (a broken sample) comes out black.
+inline uint8_t quantize(double sum, double inv) {
+  double v = std::sqrt(inv * sum);
+  v = v > 0 ? v : 0;
+  v = v < 0.999 ? v : 0.999;
+  return uint8_t(static_cast<int>(256 * v));
+}
+
+void quantize_row_scalar(const Image &img, int j, int i0, uint8_t *out) {
+  for (int i = i0; i < img.width; ++i) {
+    int p = img.slot(i + j * img.width);
+    double inv = 1.0 / std::max(img.sampleCount[p], 1);
+    for (int c = 0; c < 3; ++c)
+      *out++ = quantize(img.data[p][c], inv);
+  }
+}
+
+#ifdef IMAGE_WRITER_X86
+bool has_avx2() {
+  static const bool avx2 = __builtin_cpu_supports("avx2");
+  return avx2;
+}
+
+/// Four pixels (twelve channels) per iteration, operation for operation
+/// the same as quantize(); max(v, 0) returns its second operand for NaN.
+/// Returns the number of pixels done.
+__attribute__((target("avx2"))) int quantize_row_avx2(const Image &img, int j,
+                                                      uint8_t *out) {
+  const double *sums = img.data[img.slot(j * img.width)].e;
+  const int *counts = &img.sampleCount[img.slot(j * img.width)];
+  const __m256d zero = _mm256_setzero_pd();
+  const __m256d top = _mm256_set1_pd(0.999);
+  const __m256d scale = _mm256_set1_pd(256);
+  const __m128i one = _mm_set1_epi32(1);
+  int i = 0;
+  for (; i + 4 <= img.width; i += 4) {
+    __m128i n = _mm_max_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(counts + i)), one);
+    __m256d inv = _mm256_div_pd(_mm256_set1_pd(1), _mm256_cvtepi32_pd(n));
+    // Spread the four per-pixel factors over r0 g0 b0 r1 | g1 b1 r2 g2 |
+    // b2 r3 g3 b3.
+    __m256d invs[3] = {_mm256_permute4x64_pd(inv, _MM_SHUFFLE(1, 0, 0, 0)),
+                       _mm256_permute4x64_pd(inv, _MM_SHUFFLE(2, 2, 1, 1)),
+                       _mm256_permute4x64_pd(inv, _MM_SHUFFLE(3, 3, 3, 2))};
+    __m128i q[3];
+    for (int k = 0; k < 3; ++k) {
+      __m256d v = _mm256_loadu_pd(sums + 3 * i + 4 * k);
+      v = _mm256_sqrt_pd(_mm256_mul_pd(invs[k], v));
+      v = _mm256_min_pd(_mm256_max_pd(v, zero), top);
+      q[k] = _mm256_cvttpd_epi32(_mm256_mul_pd(v, scale));
+    }
+    __m128i bytes = _mm_packus_epi16(_mm_packus_epi32(q[0], q[1]),
+                                     _mm_packus_epi32(q[2], q[2]));
+    alignas(16) uint8_t lanes[16];
+    _mm_store_si128(reinterpret_cast<__m128i *>(lanes), bytes);
+    std::memcpy(out + 3 * i, lanes, 12);
+  }
+  return i;
+}
+#endif
+
+// Deflate (RFC 1951) with dynamic Huffman codes, wrapped in zlib (RFC
+// 1950).
+
+class BitWriter {
+public:
+  explicit BitWriter(std::string &out) : out(out) {}
+
+  /// Append the low n bits of v, least significant first.
+  void put(uint32_t v, int n) {
+    bits |= uint64_t(v) << count;
+    count += n;
+    while (count >= 8) {
+      out.push_back(char(bits));
+      bits >>= 8;
+      count -= 8;
+    }
+  }
+
+  /// Append an n-bit Huffman code, which deflate stores most significant
+  /// bit first.
+  void put_code(uint32_t code, int n) {
+    uint32_t reversed = 0;
+    for (int b = 0; b < n; ++b)
+      reversed |= (code >> b & 1) << (n - 1 - b);
+    put(reversed, n);
+  }
+
+  void flush() {
+    if (count > 0)
+      out.push_back(char(bits));
+    bits = 0;
+    count = 0;
+  }
+
+private:
+  std::string &out;
+  uint64_t bits = 0;
+  int count = 0;
+};
+
+const int lengthBase[29] = {3,  4,  5,  6,   7,   8,   9,   10,  11, 13,
+                            15, 17, 19, 23,  27,  31,  35,  43,  51, 59,
+                            67, 83, 99, 115, 131, 163, 195, 227, 258};
+const int lengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                             2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+const int distBase[30] = {1,    2,    3,    4,    5,    7,     9,     13,
+                          17,   25,   33,   49,   65,   97,    129,   193,
+                          257,  385,  513,  769,  1025, 1537,  2049,  3073,
+                          4097, 6145, 8193, 12289, 16385, 24577};
+const int distExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2,  3,  3,  4,  4,  5,  5,  6,
+                           6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+/// A literal (distance 0) or a back reference.
+struct Token {
+  uint16_t value; // literal byte or match length
+  uint16_t distance;
+};
+
+/// Greedy LZ77 over a 32 KiB window with hash chains.
+std::vector<Token> lz77(const uint8_t *d, int n) {
+  constexpr int window = 1 << 15, hashBits = 15, maxChain = 64;
+  constexpr int minMatch = 3, maxMatch = 258;
+  std::vector<int> head(1 << hashBits, -1), prev(window, -1);
+  auto hash = [&](int i) {
+    uint32_t v = d[i] | d[i + 1] << 8 | d[i + 2] << 16;
+    return (v * 2654435761u) >> (32 - hashBits);
+  };
+  auto insert = [&](int i) {
+    if (i + minMatch <= n) {
+      uint32_t h = hash(i);
+      prev[i & (window - 1)] = head[h];
+      head[h] = i;
+    }
+  };
+
+  std::vector<Token> tokens;
+  for (int i = 0; i < n;) {
+    int bestLen = 0, bestDist = 0;
+    if (i + minMatch <= n) {
+      int limit = std::min(maxMatch, n - i);
+      int cand = head[hash(i)];
+      for (int chain = 0; cand >= 0 && i - cand <= window && chain < maxChain;
+           ++chain) {
+        int len = 0;
+        while (len < limit && d[cand + len] == d[i + len])
+          ++len;
+        if (len > bestLen) {
+          bestLen = len;
+          bestDist = i - cand;
+          if (len == limit)
+            break;
+        }
+        // Ring slots get reused; a newer entry ends the chain.
+        int next = prev[cand & (window - 1)];
+        if (next >= cand)
+          break;
+        cand = next;
+      }
+    }
+    if (bestLen >= minMatch) {
+      tokens.push_back({uint16_t(bestLen), uint16_t(bestDist)});
+      for (int k = 0; k < bestLen; ++k)
+        insert(i + k);
+      i += bestLen;
+    } else {
+      tokens.push_back({d[i], 0});
+      insert(i);
+      ++i;
+    }
+  }
+  return tokens;
+}
+
+int length_code(int length) {
+  return int(std::upper_bound(lengthBase, lengthBase + 29, length) -
+             lengthBase) - 1;
+}
+
+int distance_code(int distance) {
+  return int(std::upper_bound(distBase, distBase + 30, distance) -
+             distBase) - 1;
+}
+
+/// Huffman code lengths for freq, no longer than maxBits. Too deep trees
+/// are rebuilt from halved frequencies, which flattens them.
+std::vector<uint8_t> huffman_lengths(std::vector<uint32_t> freq,
+                                     int maxBits) {
+  const int n = int(freq.size());
+  std::vector<uint8_t> lengths(n, 0);
+  for (;;) {
+    // Nodes [0, n) are the symbols; parent[] links every node to its
+    // parent as pairs are merged.
+    std::vector<int> parent(n, -1);
+    using Entry = std::pair<uint64_t, int>;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> heap;
+    for (int s = 0; s < n; ++s)
+      if (freq[s] > 0)
+        heap.push({freq[s], s});
+    if (heap.size() == 1) {
+      lengths[heap.top().second] = 1;
+      return lengths;
+    }
+    while (heap.size() > 1) {
+      Entry a = heap.top();
+      heap.pop();
+      Entry b = heap.top();
+      heap.pop();
+      int node = int(parent.size());
+      parent.push_back(-1);
+      parent[a.second] = parent[b.second] = node;
+      heap.push({a.first + b.first, node});
+    }
+
+    int deepest = 0;
+    for (int s = 0; s < n; ++s) {
+      int depth = 0;
+      if (freq[s] > 0)
+        for (int v = s; parent[v] >= 0; v = parent[v])
+          ++depth;
+      lengths[s] = uint8_t(depth);
+      deepest = std::max(deepest, depth);
+    }
+    if (deepest <= maxBits)
+      return lengths;
+    for (auto &f : freq)
+      f = f > 0 ? std::max(1u, f / 2) : 0;
+  }
+}
+
+/// Canonical codes for lengths (RFC 1951, 3.2.2).
+std::vector<uint32_t> canonical_codes(const std::vector<uint8_t> &lengths) {
+  uint32_t count[16] = {}, next[16] = {};
+  for (uint8_t l : lengths)
+    ++count[l];
+  count[0] = 0;
+  for (int bits = 1, code = 0; bits < 16; ++bits) {
+    code = (code + count[bits - 1]) << 1;
+    next[bits] = code;
+  }
+  std::vector<uint32_t> codes(lengths.size(), 0);
+  for (size_t s = 0; s < lengths.size(); ++s)
+    if (lengths[s])
+      codes[s] = next[lengths[s]]++;
+  return codes;
+}
+
+/// zlib stream of data, coded as a single dynamic-Huffman block.
+std::string zlib_compress(const std::string &data) {
+  const auto *d = reinterpret_cast<const uint8_t *>(data.data());
+  const int n = int(data.size());
+  std::vector<Token> tokens = lz77(d, n);
+
+  std::vector<uint32_t> litFreq(286, 0), distFreq(30, 0);
+  for (const Token &t : tokens) {
+    if (t.distance == 0) {
+      ++litFreq[t.value];
+    } else {
+      ++litFreq[257 + length_code(t.value)];
+      ++distFreq[distance_code(t.distance)];
+    }
+  }
+  ++litFreq[256]; // end of block
+  // A block needs at least one distance code, even if unused.
+  if (std::all_of(distFreq.begin(), distFreq.end(),
+                  [](uint32_t f) { return f == 0; }))
+    distFreq[0] = 1;
+  auto litLengths = huffman_lengths(litFreq, 15);
+  auto distLengths = huffman_lengths(distFreq, 15);
+  auto litCodes = canonical_codes(litLengths);
+  auto distCodes = canonical_codes(distLengths);
+
+  int hlit = 286, hdist = 30;
+  while (hlit > 257 && litLengths[hlit - 1] == 0)
+    --hlit;
+  while (hdist > 1 && distLengths[hdist - 1] == 0)
+    --hdist;
+
+  // The code lengths themselves, run-length coded with symbols 16 (repeat
+  // the previous length 3-6 times), 17 (3-10 zeros) and 18 (11-138 zeros).
+  std::vector<uint8_t> all(litLengths.begin(), litLengths.begin() + hlit);
+  all.insert(all.end(), distLengths.begin(), distLengths.begin() + hdist);
+  std::vector<std::pair<int, int>> runs; // (symbol, extra bits value)
+  for (size_t i = 0; i < all.size();) {
+    size_t run = 1;
+    while (i + run < all.size() && all[i + run] == all[i])
+      ++run;
+    if (all[i] == 0 && run >= 11) {
+      run = std::min<size_t>(run, 138);
+      runs.push_back({18, int(run) - 11});
+    } else if (all[i] == 0 && run >= 3) {
+      runs.push_back({17, int(run) - 3});
+    } else if (all[i] != 0 && run >= 4) {
+      run = std::min<size_t>(run, 7);
+      runs.push_back({all[i], 0});
+      runs.push_back({16, int(run) - 4});
+    } else {
+      run = 1;
+      runs.push_back({all[i], 0});
+    }
+    i += run;
+  }
+  std::vector<uint32_t> clFreq(19, 0);
+  for (const auto &r : runs)
+    ++clFreq[r.first];
+  auto clLengths = huffman_lengths(clFreq, 7);
+  auto clCodes = canonical_codes(clLengths);
+  static const int clOrder[19] = {16, 17, 18, 0, 8,  7, 9,  6, 10, 5,
+                                  11, 4,  12, 3, 13, 2, 14, 1, 15};
+  int hclen = 19;
+  while (hclen > 4 && clLengths[clOrder[hclen - 1]] == 0)
+    --hclen;
+
+  std::string out = {0x78, 0x01};
+  BitWriter bw(out);
+  bw.put(1, 1); // final block
+  bw.put(2, 2); // dynamic Huffman codes
+  bw.put(hlit - 257, 5);
+  bw.put(hdist - 1, 5);
+  bw.put(hclen - 4, 4);
+  for (int k = 0; k < hclen; ++k)
+    bw.put(clLengths[clOrder[k]], 3);
+  static const int runExtraBits[3] = {2, 3, 7};
+  for (const auto &r : runs) {
+    bw.put_code(clCodes[r.first], clLengths[r.first]);
+    if (r.first >= 16)
+      bw.put(r.second, runExtraBits[r.first - 16]);
+  }
+
+  for (const Token &t : tokens) {
+    if (t.distance == 0) {
+      bw.put_code(litCodes[t.value], litLengths[t.value]);
+      continue;
+    }
+    int l = length_code(t.value);
+    bw.put_code(litCodes[257 + l], litLengths[257 + l]);
+    bw.put(t.value - lengthBase[l], lengthExtra[l]);
+    int dc = distance_code(t.distance);
+    bw.put_code(distCodes[dc], distLengths[dc]);
+    bw.put(t.distance - distBase[dc], distExtra[dc]);
+  }
+  bw.put_code(litCodes[256], litLengths[256]);
+  bw.flush();
+
+  uint32_t a = 1, b = 0;
+  for (int i = 0; i < n; ++i) {
+    a = (a + d[i]) % 65521;
+    b = (b + a) % 65521;
+  }
+  uint32_t adler = b << 16 | a;
+  for (int shift = 24; shift >= 0; shift -= 8)
+    out.push_back(char(adler >> shift));
+  return out;
+}
+
+uint32_t crc32(const std::string &bytes) {
+  static const auto table = [] {
+    std::vector<uint32_t> t(256);
+    for (uint32_t n = 0; n < 256; ++n) {
+      uint32_t c = n;
+      for (int k = 0; k < 8; ++k)
+        c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+      t[n] = c;
+    }
+    return t;
+  }();
+  uint32_t c = 0xffffffffu;
+  for (char ch : bytes)
+    c = table[(c ^ uint8_t(ch)) & 0xff] ^ (c >> 8);
+  return c ^ 0xffffffffu;
+}
+
+void put_be32(std::string &s, uint32_t v) {
+  for (int shift = 24; shift >= 0; shift -= 8)
+    s.push_back(char(v >> shift));
+}
+
+void write_chunk(std::ostream &out, const char *type, const std::string &data) {
+  std::string chunk = type + data;
+  std::string length;
+  put_be32(length, uint32_t(data.size()));
+  std::string crc;
+  put_be32(crc, crc32(chunk));
+  out << length << chunk << crc;
+}
+
+inline uint8_t paeth(int a, int b, int c) {
+  int p = a + b - c;
+  int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+  return uint8_t(pa <= pb && pa <= pc ? a : pb <= pc ? b : c);
+}
+
+} // namespace
+
+void quantize_row(const Image &img, int j, uint8_t *out) {
+  int done = 0;
+#ifdef IMAGE_WRITER_X86
+  // The kernel reads the sums as a packed double array.
+  if (Color::lanes == 3 && has_avx2())
+    done = quantize_row_avx2(img, j, out);
+#endif
+  quantize_row_scalar(img, j, done, out + 3 * done);
+}
+
+void P3Writer::write(std::ostream &out, const Image &img) const { out << img; }
+
+void RowWriter::write(std::ostream &out, const Image &img) const {
+  out << header(img.width, img.height);
+  std::vector<char> row(row_bytes(img.width));
+  for (int k = 0; k < img.height; ++k) {
+    encode_row(img, bottom_up() ? k : img.height - 1 - k, row.data());
+    out.write(row.data(), row.size());
+  }
+}
+
+std::string P6Writer::header(int width, int height) const {
+  return "P6\n" + std::to_string(width) + ' ' + std::to_string(height) +
+         "\n255\n";
+}
+
+void P6Writer::encode_row(const Image &img, int j, char *out) const {
+  quantize_row(img, j, reinterpret_cast<uint8_t *>(out));
+}
+
+void PngWriter::write(std::ostream &out, const Image &img) const {
+  const size_t stride = 3 * size_t(img.width);
+  // Each row is stored as a filter type byte and the filtered bytes;
+  // the filter with the smallest sum of |signed byte| usually deflates
+  // best.
+  std::string raw;
+  raw.reserve((stride + 1) * img.height);
+  std::vector<uint8_t> prior(stride, 0), row(stride);
+  std::vector<uint8_t> candidate[5];
+  for (auto &c : candidate)
+    c.resize(stride);
+  for (int j = img.height - 1; j >= 0; --j) {
+    quantize_row(img, j, row.data());
+    int best = 0;
+    long bestCost = -1;
+    for (int f = 0; f < 5; ++f) {
+      long cost = 0;
+      for (size_t k = 0; k < stride; ++k) {
+        int a = k >= 3 ? row[k - 3] : 0, b = prior[k];
+        int c = k >= 3 ? prior[k - 3] : 0;
+        int predict = f == 0   ? 0
+                      : f == 1 ? a
+                      : f == 2 ? b
+                      : f == 3 ? (a + b) / 2
+                               : paeth(a, b, c);
+        uint8_t v = uint8_t(row[k] - predict);
+        candidate[f][k] = v;
+        cost += std::abs(int(int8_t(v)));
+      }
+      if (bestCost < 0 || cost < bestCost) {
+        best = f;
+        bestCost = cost;
+      }
+    }
+    raw.push_back(char(best));
+    raw.append(reinterpret_cast<const char *>(candidate[best].data()),
+               stride);
+    std::swap(prior, row);
+  }
+
+  out.write("\x89PNG\r\n\x1a\n", 8);
+  std::string header;
+  put_be32(header, img.width);
+  put_be32(header, img.height);
+  header += {8, 2, 0, 0, 0}; // 8-bit RGB, deflate, no interlace
+  write_chunk(out, "IHDR", header);
+  write_chunk(out, "IDAT", zlib_compress(raw));
+  write_chunk(out, "IEND", "");
+}
+
+std::string PfmWriter::header(int width, int height) const {
+  // A negative scale marks little-endian floats; PFM rows run bottom to
+  // top like Image::data.
+  const uint16_t probe = 1;
+  bool little = *reinterpret_cast<const uint8_t *>(&probe) == 1;
+  return "PF\n" + std::to_string(width) + ' ' + std::to_string(height) +
+         (little ? "\n-1.0\n" : "\n1.0\n");
+}
+
+void PfmWriter::encode_row(const Image &img, int j, char *out) const {
+  for (int i = 0; i < img.width; ++i) {
+    int p = img.slot(i + j * img.width);
+    double inv = 1.0 / std::max(img.sampleCount[p], 1);
+    for (int c = 0; c < 3; ++c) {
+      float v = float(img.data[p][c] * inv);
+      std::memcpy(out, &v, sizeof(v));
+      out += sizeof(v);
+    }
+  }
+}
+
+StreamingOutput::StreamingOutput(const RowWriter &format,
+                                 const std::string &path, int width,
+                                 int height)
+    : format(format), height(height) {
+  std::string head = format.header(width, height);
+  headerBytes = head.size();
+  rowBytes = format.row_bytes(width);
+#ifdef IMAGE_WRITER_POSIX
+  fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  // Allocate the whole file up front, so a full disk shows up now rather
+  // than hours into the render.
+  if (fd >= 0 && ::ftruncate(fd, off_t(headerBytes + rowBytes * height)) != 0)
+    failed = true;
+  if (fd >= 0)
+    write_at(head, 0);
+#else
+  (void)path;
+#endif
+}
+
+StreamingOutput::~StreamingOutput() {
+#ifdef IMAGE_WRITER_POSIX
+  if (fd >= 0)
+    ::close(fd);
+#endif
+}
+
+void StreamingOutput::write_rows(const Image &img, int y0, int y1) {
+  // The rows of a band are contiguous in the file, in one order or the
+  // other.
+  std::string band((y1 - y0) * rowBytes, '\0');
+  const int first = format.bottom_up() ? y0 : height - y1;
+  for (int j = y0; j < y1; ++j) {
+    int fileRow = format.bottom_up() ? j : height - 1 - j;
+    format.encode_row(img, j, &band[(fileRow - first) * rowBytes]);
+  }
+  write_at(band, headerBytes + first * rowBytes);
+}
+
+void StreamingOutput::write_at(const std::string &bytes, size_t offset) {
+#ifdef IMAGE_WRITER_POSIX
+  for (size_t done = 0; done < bytes.size();) {
+    ssize_t n = ::pwrite(fd, bytes.data() + done, bytes.size() - done,
+                         off_t(offset + done));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      failed = true;
+      return;
+    }
+    done += size_t(n);
+  }
+#else
+  (void)bytes;
+  (void)offset;
+  failed = true;
+#endif
+}
+
+std::unique_ptr<ImageWriter> make_image_writer(const std::string &format,
+                                               const std::string &path) {
+  std::string f = format;
+  if (f == "auto") {
+    auto dot = path.rfind('.');
+    std::string ext = dot == std::string::npos ? "" : path.substr(dot + 1);
+    for (char &ch : ext)
+      ch = char(std::tolower(uint8_t(ch)));
+    f = ext == "ppm" ? "p6" : ext;
+  }
+  if (f == "p3")
+    return std::make_unique<P3Writer>();
+  if (f == "p6")
+    return std::make_unique<P6Writer>();
+  if (f == "png")
+    return std::make_unique<PngWriter>();
+  if (f == "pfm")
+    return std::make_unique<PfmWriter>();
+  return nullptr;
+}
@@ -0,0 +1,43 @@
+#include "PerfCounter.h"
+
+#ifdef __linux__
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+CacheMissCounter::CacheMissCounter() {
+#ifdef __linux__
+  perf_event_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = PERF_COUNT_HW_CACHE_MISSES;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  // pid 0, cpu -1: this thread, on whichever CPU it runs.
+  fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+}
+
+CacheMissCounter::~CacheMissCounter() {
+#ifdef __linux__
+  if (fd >= 0)
+    close(fd);
+#endif
+}
+
+uint64_t CacheMissCounter::read() const {
+  uint64_t count = 0;
+#ifdef __linux__
+  if (fd >= 0 && ::read(fd, &count, sizeof(count)) != sizeof(count))
+    count = 0;
+#endif
+  return count;
+}
+
+CacheMissCounter &thread_cache_misses() {
+  static thread_local CacheMissCounter counter;
+  return counter;
+}
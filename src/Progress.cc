@@ -0,0 +1,113 @@
+#include "Progress.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <string>
+
+namespace {
+
+/// h:mm:ss, or the seconds alone below a minute.
+std::string format_duration(double seconds) {
+  long s = long(seconds + 0.5);
+  char buf[32];
+  if (s < 60)
+    std::snprintf(buf, sizeof(buf), "%lds", s);
+  else
+    std::snprintf(buf, sizeof(buf), "%ld:%02ld:%02ld", s / 3600,
+                  s / 60 % 60, s % 60);
+  return buf;
+}
+
+} // namespace
+
+Progress::Progress(ProgressStyle style, uint64_t totalSamples, double budget,
+                   double interval)
+    : style(style), totalSamples(totalSamples), budget(budget),
+      interval(interval) {
+  if (style != ProgressStyle::Quiet)
+    thread = std::thread([this] { run(); });
+}
+
+Progress::~Progress() {
+  if (!thread.joinable())
+    return;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stop = true;
+  }
+  wake.notify_one();
+  thread.join();
+  report(true);
+}
+
+void Progress::add_thread_work() {
+  WorkCounters &work = thread_work();
+  samples.fetch_add(work.samples, std::memory_order_relaxed);
+  rays.fetch_add(work.rays, std::memory_order_relaxed);
+  work = WorkCounters();
+}
+
+void Progress::run() {
+  std::unique_lock<std::mutex> lock(mutex);
+  auto period = std::chrono::duration<double>(interval);
+  while (!wake.wait_for(lock, period, [this] { return stop; })) {
+    lock.unlock();
+    report(false);
+    lock.lock();
+  }
+}
+
+void Progress::report(bool final) {
+  const double elapsed =
+      std::chrono::duration<double>(Clock::now() - start).count();
+  const uint64_t done = samples.load(std::memory_order_relaxed);
+  const uint64_t traced = rays.load(std::memory_order_relaxed);
+  const double mrays = elapsed > 0 ? traced / elapsed * 1e-6 : 0;
+  // Fraction done and seconds left, or negative when unknown.
+  double fraction = -1, eta = -1;
+  if (final) {
+    fraction = 1;
+    eta = 0;
+  } else if (totalSamples > 0) {
+    fraction = std::min(1.0, double(done) / totalSamples);
+    if (fraction > 0)
+      eta = elapsed * (1 - fraction) / fraction;
+  } else if (budget > 0) {
+    fraction = std::min(1.0, elapsed / budget);
+    eta = std::max(0.0, budget - elapsed);
+  }
+
+  if (style == ProgressStyle::Json) {
+    char buf[320];
+    char percent[32] = "null", left[32] = "null", passText[16] = "null";
+    if (pass >= 0)
+      std::snprintf(passText, sizeof(passText), "%d", pass.load());
+    if (fraction >= 0)
+      std::snprintf(percent, sizeof(percent), "%.2f", 100 * fraction);
+    if (eta >= 0)
+      std::snprintf(left, sizeof(left), "%.1f", eta);
+    std::snprintf(buf, sizeof(buf),
+                  "{\"event\":\"%s\",\"pass\":%s,\"samples\":%llu,"
+                  "\"rays\":%llu,\"percent\":%s,\"mrays_per_s\":%.3f,"
+                  "\"elapsed_s\":%.2f,\"eta_s\":%s}\n",
+                  final ? "done" : "progress", passText,
+                  (unsigned long long)done, (unsigned long long)traced,
+                  percent, mrays, elapsed, left);
+    std::cout << buf << std::flush;
+    return;
+  }
+
+  char buf[160];
+  int n = std::snprintf(buf, sizeof(buf), "\r%s", final ? "Done: " : "");
+  if (fraction >= 0)
+    n += std::snprintf(buf + n, sizeof(buf) - n, "%5.1f%% | ",
+                       100 * fraction);
+  if (pass >= 0)
+    n += std::snprintf(buf + n, sizeof(buf) - n, "pass %d | ", pass.load());
+  n += std::snprintf(buf + n, sizeof(buf) - n, "%.2f Mrays/s | ", mrays);
+  std::string time = final      ? format_duration(elapsed)
+                     : eta >= 0 ? "ETA " + format_duration(eta)
+                                : format_duration(elapsed) + " elapsed";
+  std::cerr << buf << time << "    " << std::flush;
+}
@@ -0,0 +1,78 @@
+#include "RayStats.h"
+#include "Material.h"
+
+#include <iomanip>
+#include <ostream>
+
+namespace {
+
+const char *pathEndNames[pathEndCount] = {"escaped", "absorbed", "roulette",
+                                          "depth_limit"};
+const char *materialNames[materialTypeCount] = {"lambertian", "metal",
+                                                "dielectric"};
+static_assert(materialTypeCount <= RayStats::materialBins,
+              "RayStats::scatters has a bin per material type");
+
+double per(uint64_t n, uint64_t d) { return d ? double(n) / d : 0; }
+
+} // namespace
+
+void print_ray_stats(std::ostream &out, const RayStats &s, double seconds) {
+  const uint64_t rays = s.primaryRays + s.secondaryRays;
+  uint64_t paths = 0;
+  for (uint64_t n : s.pathEnds)
+    paths += n;
+  out << "Ray statistics:\n"
+      << "  rays: " << s.primaryRays << " primary, " << s.secondaryRays
+      << " secondary (" << per(rays, s.primaryRays) << " per path, "
+      << (seconds > 0 ? rays / seconds * 1e-6 : 0) << " Mrays/s)\n"
+      << "  paths ended:";
+  for (int k = 0; k < pathEndCount; ++k)
+    out << (k ? ", " : " ") << pathEndNames[k] << ' ' << s.pathEnds[k];
+  out << "\n  sphere tests: " << s.sphereTests << ", hits " << s.sphereHits
+      << " (" << 100 * per(s.sphereHits, s.sphereTests) << "%)\n"
+      << "  per ray: " << per(s.nodeVisits, rays) << " BVH nodes, "
+      << per(s.listVisits, rays) << " list objects, "
+      << per(s.sphereTests, rays) << " sphere tests\n"
+      << "  scatter calls:";
+  for (int k = 0; k < materialTypeCount; ++k)
+    out << (k ? ", " : " ") << materialNames[k] << ' ' << s.scatters[k];
+  // Bins are listed until what is left is under 0.1% of the paths, which
+  // is then shown as one "k+" bin.
+  out << "\n  bounces per path:" << std::setprecision(3);
+  uint64_t left = paths;
+  for (int k = 0; k < RayStats::depthBins && left > 0; ++k) {
+    if (k == RayStats::depthBins - 1 || left * 1000 < paths) {
+      out << ' ' << k << "+: " << 100 * per(left, paths) << '%';
+      break;
+    }
+    out << ' ' << k << ": " << 100 * per(s.depthHistogram[k], paths) << '%';
+    left -= s.depthHistogram[k];
+  }
+  out << std::setprecision(6) << '\n';
+}
+
+void write_ray_stats_json(std::ostream &out, const RayStats &s,
+                          double seconds) {
+  const uint64_t rays = s.primaryRays + s.secondaryRays;
+  out << "{\"seconds\":" << seconds << ",\"primary_rays\":" << s.primaryRays
+      << ",\"secondary_rays\":" << s.secondaryRays << ",\"mrays_per_s\":"
+      << (seconds > 0 ? rays / seconds * 1e-6 : 0) << ",\"path_ends\":{";
+  for (int k = 0; k < pathEndCount; ++k)
+    out << (k ? "," : "") << '"' << pathEndNames[k] << "\":" << s.pathEnds[k];
+  out << "},\"sphere_tests\":" << s.sphereTests
+      << ",\"sphere_hits\":" << s.sphereHits
+      << ",\"node_visits\":" << s.nodeVisits
+      << ",\"list_visits\":" << s.listVisits << ",\"scatters\":{";
+  for (int k = 0; k < materialTypeCount; ++k)
+    out << (k ? "," : "") << '"' << materialNames[k] << "\":" << s.scatters[k];
+  // Trailing empty bins are left out; the last bin also counts deeper
+  // paths.
+  int bins = RayStats::depthBins;
+  while (bins > 0 && s.depthHistogram[bins - 1] == 0)
+    --bins;
+  out << "},\"depth_histogram\":[";
+  for (int k = 0; k < bins; ++k)
+    out << (k ? "," : "") << s.depthHistogram[k];
+  out << "]}\n";
+}
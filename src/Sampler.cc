@@ -0,0 +1,187 @@
+#include "Sampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace {
+
+/// Hash of a (pixel, dimension) pair under seed.
+inline uint64_t sample_key(uint64_t seed, uint32_t pixel, uint32_t dim) {
+  return mix_bits(seed ^ mix_bits(uint64_t(pixel) << 32 | dim));
+}
+
+inline uint32_t reverse_bits(uint32_t x) {
+  x = (x << 16) | (x >> 16);
+  x = ((x & 0x00ff00ff) << 8) | ((x & 0xff00ff00) >> 8);
+  x = ((x & 0x0f0f0f0f) << 4) | ((x & 0xf0f0f0f0) >> 4);
+  x = ((x & 0x33333333) << 2) | ((x & 0xcccccccc) >> 2);
+  x = ((x & 0x55555555) << 1) | ((x & 0xaaaaaaaa) >> 1);
+  return x;
+}
+
+/// Second Sobol dimension; the first is reverse_bits(i).
+inline uint32_t sobol_dim1(uint32_t i) {
+  uint32_t r = 0;
+  for (uint32_t v = 1u << 31; i; i >>= 1, v ^= v >> 1)
+    if (i & 1)
+      r ^= v;
+  return r;
+}
+
+/// Owen scrambling of a 0.32 fixed-point value: the Laine-Karras hash
+/// applied to the reversed bits, where every bit depends only on the bits
+/// above it, as Owen's nested permutations require.
+inline uint32_t owen_scramble(uint32_t x, uint32_t seed) {
+  x = reverse_bits(x);
+  x += seed;
+  x ^= x * 0x6c50b47cu;
+  x ^= x * 0xb82f1e52u;
+  x ^= x * 0xc7afe638u;
+  x ^= x * 0x8d22f6e6u;
+  return reverse_bits(x);
+}
+
+/// Element i of a random permutation of [0, n) chosen by p, without
+/// storing the permutation (Kensler 2013).
+uint32_t permutation_element(uint32_t i, uint32_t n, uint32_t p) {
+  uint32_t w = n - 1;
+  w |= w >> 1;
+  w |= w >> 2;
+  w |= w >> 4;
+  w |= w >> 8;
+  w |= w >> 16;
+  do {
+    i ^= p;
+    i *= 0xe170893d;
+    i ^= p >> 16;
+    i ^= (i & w) >> 4;
+    i ^= p >> 8;
+    i *= 0x0929eb3f;
+    i ^= p >> 23;
+    i ^= (i & w) >> 1;
+    i *= 1 | p >> 27;
+    i *= 0x6935fa69;
+    i ^= (i & w) >> 11;
+    i *= 0x74dcb303;
+    i ^= (i & w) >> 2;
+    i *= 0x9e501cc3;
+    i ^= (i & w) >> 2;
+    i *= 0xc860a3df;
+    i &= w;
+    i ^= i >> 5;
+  } while (i >= n);
+  return (i + p) % n;
+}
+
+/// A size x size blue-noise mask in 0.32 fixed point: the pixels are ranked
+/// by repeatedly taking the largest void, i.e. the free pixel with the
+/// least Gaussian energy from those already taken (the last phase of
+/// Ulichney's void-and-cluster), and rank r becomes (r + 1/2) / size^2.
+std::vector<uint32_t> make_blue_noise(int size, uint64_t seed) {
+  const int n = size * size;
+  const double sigma = 1.5;
+  // Energy falloff by toroidal offset.
+  std::vector<double> kernel(n);
+  for (int dy = 0; dy < size; ++dy) {
+    for (int dx = 0; dx < size; ++dx) {
+      int x = std::min(dx, size - dx), y = std::min(dy, size - dy);
+      kernel[dx + dy * size] = std::exp(-(x * x + y * y) / (2 * sigma * sigma));
+    }
+  }
+
+  std::vector<double> energy(n, 0);
+  std::vector<uint32_t> mask(n, 0);
+  std::vector<bool> taken(n, false);
+  const uint32_t step = uint32_t((uint64_t(1) << 32) / n);
+  int next = int(mix_bits(seed) % n);
+  for (int rank = 0; rank < n; ++rank) {
+    taken[next] = true;
+    mask[next] = rank * step + step / 2;
+    int px = next % size, py = next / size;
+    for (int y = 0; y < size; ++y) {
+      const double *row = &kernel[((y - py + size) % size) * size];
+      for (int x = 0; x < size; ++x)
+        energy[x + y * size] += row[(x - px + size) % size];
+    }
+    double least = std::numeric_limits<double>::infinity();
+    for (int p = 0; p < n; ++p) {
+      if (!taken[p] && energy[p] < least) {
+        least = energy[p];
+        next = p;
+      }
+    }
+  }
+  return mask;
+}
+
+} // namespace
+
+Sample2D IndependentSampler::get_2d(uint32_t pixel, uint32_t sample,
+                                    uint32_t dim) const {
+  uint64_t bits = mix_bits(sample_key(seed, pixel, dim) + sample);
+  return {uint32_t(bits), uint32_t(bits >> 32)};
+}
+
+StratifiedSampler::StratifiedSampler(int samplesPerPixel, uint64_t seed)
+    : seed(seed) {
+  nx = std::max(1, int(std::sqrt(double(samplesPerPixel))));
+  ny = std::max(1, (samplesPerPixel + int(nx) - 1) / int(nx));
+}
+
+Sample2D StratifiedSampler::get_2d(uint32_t pixel, uint32_t sample,
+                                   uint32_t dim) const {
+  uint64_t key = sample_key(seed, pixel, dim);
+  uint32_t strata = nx * ny;
+  uint32_t stratum = permutation_element(sample % strata, strata, key);
+  uint64_t jitter = mix_bits(key + sample);
+  // (stratum + jitter) / n, in fixed point.
+  uint64_t x = uint64_t(stratum % nx) << 32 | uint32_t(jitter);
+  uint64_t y = uint64_t(stratum / nx) << 32 | uint32_t(jitter >> 32);
+  return {uint32_t(x / nx), uint32_t(y / ny)};
+}
+
+Sample2D SobolSampler::get_2d(uint32_t pixel, uint32_t sample,
+                              uint32_t dim) const {
+  uint64_t key = sample_key(seed, pixel, dim);
+  uint64_t key2 = mix_bits(key);
+  // Scrambling the index as a radical inverse shuffles it within aligned
+  // power-of-two blocks, which keeps the stratification of every prefix.
+  uint32_t index = owen_scramble(sample, uint32_t(key));
+  return {owen_scramble(reverse_bits(index), uint32_t(key >> 32)),
+          owen_scramble(sobol_dim1(index), uint32_t(key2))};
+}
+
+BlueNoiseSampler::BlueNoiseSampler(int width, uint64_t seed)
+    : width(width), seed(seed), mask(make_blue_noise(maskSize, seed)) {}
+
+Sample2D BlueNoiseSampler::get_2d(uint32_t pixel, uint32_t sample,
+                                  uint32_t dim) const {
+  // Index and mask offsets depend on the dimension only, so sample s of
+  // every pixel comes from the same Sobol point.
+  uint64_t key = sample_key(seed, 0, dim);
+  uint64_t offset = mix_bits(key);
+  uint32_t index = owen_scramble(sample, uint32_t(key));
+  int x = pixel % width, y = pixel / width;
+  auto shifted = [&](int shift) {
+    int mx = (x + int(offset >> shift & 0xffff)) % maskSize;
+    int my = (y + int(offset >> (shift + 16) & 0xffff)) % maskSize;
+    return mask[mx + my * maskSize];
+  };
+  // Unsigned wraparound makes the shift toroidal.
+  return {reverse_bits(index) + shifted(0), sobol_dim1(index) + shifted(32)};
+}
+
+std::unique_ptr<Sampler> make_sampler(const std::string &name,
+                                      int samplesPerPixel, int width,
+                                      uint64_t seed) {
+  if (name == "random")
+    return std::make_unique<IndependentSampler>(seed);
+  if (name == "stratified")
+    return std::make_unique<StratifiedSampler>(samplesPerPixel, seed);
+  if (name == "sobol")
+    return std::make_unique<SobolSampler>(seed);
+  if (name == "bluenoise")
+    return std::make_unique<BlueNoiseSampler>(width, seed);
+  return nullptr;
+}
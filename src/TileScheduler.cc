@@ -0,0 +1,123 @@
+#include "TileScheduler.h"
+
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+/// A worker's deque of tile indices. The owner pops from the front while
+/// thieves take from the back, so they only meet when the deque is nearly
+/// empty. Tiles are coarse, so a mutex is cheap next to rendering one.
+struct alignas(64) WorkQueue {
+  std::mutex m;
+  std::deque<size_t> q;
+
+  bool pop(size_t &idx) {
+    std::lock_guard<std::mutex> lock(m);
+    if (q.empty())
+      return false;
+    idx = q.front();
+    q.pop_front();
+    return true;
+  }
+
+  /// Move the back half of this deque to out, returning how many were taken.
+  size_t steal_half(std::vector<size_t> &out) {
+    std::lock_guard<std::mutex> lock(m);
+    size_t n = (q.size() + 1) / 2;
+    for (size_t k = 0; k < n; ++k) {
+      out.push_back(q.back());
+      q.pop_back();
+    }
+    return n;
+  }
+
+  void push_all(const std::vector<size_t> &items) {
+    std::lock_guard<std::mutex> lock(m);
+    // Keep the stolen run in its original order for locality.
+    for (auto it = items.rbegin(); it != items.rend(); ++it)
+      q.push_back(*it);
+  }
+};
+
+} // namespace
+
+std::vector<Tile> make_tiles(int width, int height, int tileSize) {
+  std::vector<Tile> tiles;
+  tileSize = std::max(tileSize, 1);
+  for (int y = 0; y < height; y += tileSize)
+    for (int x = 0; x < width; x += tileSize)
+      tiles.push_back({x, y, std::min(x + tileSize, width),
+                       std::min(y + tileSize, height)});
+  return tiles;
+}
+
+int resolve_thread_count(int nThreads) {
+  if (nThreads > 0)
+    return nThreads;
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+SchedulerStats parallel_for_tiles(const std::vector<Tile> &tiles, int nThreads,
+                                  const std::function<void(const Tile &)> &fn) {
+  nThreads = std::max(
+      1, std::min<int>(resolve_thread_count(nThreads), tiles.size()));
+
+  // Static contiguous split; stealing fixes whatever imbalance it causes.
+  std::vector<WorkQueue> queues(nThreads);
+  for (int w = 0; w < nThreads; ++w) {
+    size_t begin = tiles.size() * w / nThreads;
+    size_t end = tiles.size() * (w + 1) / nThreads;
+    for (size_t i = begin; i < end; ++i)
+      queues[w].q.push_back(i);
+  }
+
+  SchedulerStats stats;
+  stats.executed.assign(nThreads, 0);
+  stats.stolenBy.assign(nThreads, 0);
+
+  auto worker = [&](int id) {
+    std::vector<size_t> loot;
+    size_t executed = 0, stolen = 0;
+    while (true) {
+      size_t idx;
+      if (queues[id].pop(idx)) {
+        fn(tiles[idx]);
+        ++executed;
+        continue;
+      }
+      // Tiles are never created while rendering, so once every deque is
+      // empty there is nothing left to do.
+      bool found = false;
+      for (int k = 1; k < nThreads && !found; ++k) {
+        loot.clear();
+        size_t n = queues[(id + k) % nThreads].steal_half(loot);
+        if (n) {
+          stolen += n;
+          queues[id].push_all(loot);
+          found = true;
+        }
+      }
+      if (!found)
+        break;
+    }
+    stats.executed[id] = executed;
+    stats.stolenBy[id] = stolen;
+  };
+
+  // The calling thread works too, so a single-threaded render never spawns.
+  std::vector<std::thread> pool;
+  for (int t = 1; t < nThreads; ++t)
+    pool.emplace_back(worker, t);
+  worker(0);
+  for (auto &th : pool)
+    th.join();
+
+  for (int w = 0; w < nThreads; ++w) {
+    stats.tiles += stats.executed[w];
+    stats.stolen += stats.stolenBy[w];
+  }
+  return stats;
+}
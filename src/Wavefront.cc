@@ -0,0 +1,221 @@
+#include "Image.h"
+#include "PathQueue.h"
+#include "PerfCounter.h"
+
+#include <algorithm>
+#include <chrono>
+#include <utility>
+
+namespace {
+
+/// Spread the low 6 bits of v apart, leaving two zero bits between each.
+inline uint32_t spread_bits(uint32_t v) {
+  v &= 0x3f;
+  v = (v | v << 8) & 0x300f;
+  v = (v | v << 4) & 0x30c3;
+  v = (v | v << 2) & 0x9249;
+  return v;
+}
+
+/// Reorder queue by a 21-bit key: the direction octant above the Morton
+/// code of the origin on a 64^3 grid over the origins' own bounds. Rays
+/// that leave the same region in the same octant then sit next to each
+/// other, so they fill packets LinearBVH can trace as a packet and touch
+/// the same nodes back to back. The key is radix sorted in two 11-bit
+/// passes with the queue index carried in the low 32 bits; scratch and
+/// keys are reused buffers.
+template <typename T>
+void sort_queue(PathQueue<T> &queue, PathQueue<T> &scratch,
+                std::vector<uint64_t> &keys, std::vector<uint64_t> &tmp) {
+  const size_t n = queue.size();
+  T lo[3], scale[3];
+  for (int a = 0; a < 3; ++a) {
+    auto range = std::minmax_element(queue.org[a].begin(), queue.org[a].end());
+    lo[a] = *range.first;
+    T extent = *range.second - lo[a];
+    scale[a] = extent > 0 ? T(63) / extent : T(0);
+  }
+
+  keys.resize(n);
+  tmp.resize(n);
+  for (size_t k = 0; k < n; ++k) {
+    uint64_t octant = 0, morton = 0;
+    for (int a = 0; a < 3; ++a) {
+      octant |= uint64_t(queue.dir[a][k] < 0) << a;
+      auto cell = uint32_t((queue.org[a][k] - lo[a]) * scale[a]);
+      morton |= uint64_t(spread_bits(cell)) << a;
+    }
+    keys[k] = (octant << 18 | morton) << 32 | k;
+  }
+  for (int shift = 32; shift < 54; shift += 11) {
+    size_t count[2049] = {};
+    for (uint64_t key : keys)
+      ++count[(key >> shift & 0x7ff) + 1];
+    for (int d = 0; d < 2048; ++d)
+      count[d + 1] += count[d];
+    for (uint64_t key : keys)
+      tmp[count[key >> shift & 0x7ff]++] = key;
+    std::swap(keys, tmp);
+  }
+
+  scratch.clear();
+  for (uint64_t key : keys) {
+    auto k = uint32_t(key);
+    scratch.push(queue.ray(k), queue.throughput[k], queue.path[k]);
+  }
+  std::swap(queue, scratch);
+}
+
+} // namespace
+
+/// Render a tile breadth first. Every sample the tile's pixels still need
+/// (sampleCount up to sampleTarget) becomes a path, numbered in pixel and
+/// then sample order, and each bounce runs as separate stages over the
+/// queue of live paths:
+///
+///   1. intersect all queued rays, eight at a time through hit_packet
+///   2. record misses and bin the hits by material type
+///   3. shade each bin, pushing the survivors into the next queue
+///
+/// Each path's random stream is rewound to its (path, bounce) key before
+/// it is shaded, so the image is identical to the depth-first renderer. With
+/// sortRays, the queue is sorted (see sort_queue) before each intersect
+/// stage after the first; camera rays are already coherent. Counters for
+/// those later stages are added to stats.
+template <typename T>
+void Image::render_tile_wavefront(const Tile &tile, const Camera<T> &cam,
+                                  const Hittable<T> &world,
+                                  const MaterialTable<T> &materials,
+                                  int maxDepth, WavefrontStats &stats) {
+  using Clock = std::chrono::steady_clock;
+  std::vector<int> pathPixel, pathSample;
+  for (int j = tile.y0; j < tile.y1; ++j) {
+    for (int i = tile.x0; i < tile.x1; ++i) {
+      int p = i + j * width;
+      for (int s = sampleCount[slot(p)]; s < sampleTarget[slot(p)]; ++s) {
+        pathPixel.push_back(p);
+        pathSample.push_back(s);
+      }
+    }
+  }
+  const size_t nPaths = pathPixel.size();
+
+  // Light gathered by each path; paths cut off by maxDepth gather none.
+  std::vector<Vec3<T>> radiance(nPaths);
+  PathQueue<T> queue, next;
+  queue.reserve(nPaths);
+  next.reserve(nPaths);
+  std::vector<HitRecord<T>> recs(nPaths);
+  std::vector<uint8_t> hit(nPaths);
+  std::vector<uint32_t> bins[materialTypeCount];
+  std::vector<uint64_t> keys, keysTmp;
+  auto &misses = thread_cache_misses();
+
+  // Camera rays, generated exactly as the depth-first path does.
+  for (uint32_t id = 0; id < nPaths; ++id) {
+    int i = pathPixel[id] % width, j = pathPixel[id] / width;
+    thread_rng().start_path(seed, pathPixel[id], pathSample[id],
+                              sampler.get());
+    T du, dv;
+    sample_2d(PixelDim, du, dv);
+    T u = (i + du) / (width - 1);
+    T v = (j + dv) / (height - 1);
+    queue.push(cam.getRay(u, v), Vec3<T>(1, 1, 1), id);
+  }
+
+  RayPacket<T> packet;
+  for (int bounce = 0; bounce < maxDepth && queue.size() > 0; ++bounce) {
+    if (sortRays && bounce > 0) {
+      auto start = Clock::now();
+      sort_queue(queue, next, keys, keysTmp);
+      stats.sortSeconds +=
+          std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    // Intersect.
+    const size_t n = queue.size();
+    auto start = Clock::now();
+    uint64_t missesBefore = misses.read();
+    uint64_t coherent = 0;
+    thread_work().rays += n;
+    count_ray_stat(bounce == 0 ? &RayStats::primaryRays
+                               : &RayStats::secondaryRays,
+                   n);
+    for (size_t k = 0; k < n; k += RayPacket<T>::size) {
+      uint32_t active = 0;
+      for (int l = 0; l < RayPacket<T>::size && k + l < n; ++l) {
+        packet.set(l, queue.ray(k + l));
+        active |= 1u << l;
+      }
+      coherent += packet.coherent(active);
+      uint32_t hits = world.hit_packet(packet, active, &recs[k]);
+      for (int l = 0; l < RayPacket<T>::size && k + l < n; ++l)
+        hit[k + l] = hits >> l & 1;
+    }
+    if (bounce > 0) {
+      stats.intersectSeconds +=
+          std::chrono::duration<double>(Clock::now() - start).count();
+      stats.cacheMisses += misses.read() - missesBefore;
+      stats.cacheMissesCounted = misses.available();
+      stats.rays += n;
+      stats.packets += (n + RayPacket<T>::size - 1) / RayPacket<T>::size;
+      stats.coherentPackets += coherent;
+    }
+
+    // Escaped paths take the sky; the rest are binned by material type.
+    for (auto &bin : bins)
+      bin.clear();
+    for (size_t k = 0; k < n; ++k) {
+      if (hit[k]) {
+        bins[int(materials.type(recs[k].matId))].push_back(k);
+      } else {
+        radiance[queue.path[k]] =
+            queue.throughput[k] * background(queue.ray(k));
+        count_path_end(PathEnd::Escaped, bounce);
+      }
+    }
+
+    // Shade one material type at a time, so the variant switch in scatter()
+    // always takes the same branch and only that material's code is hot.
+    next.clear();
+    for (const auto &bin : bins) {
+      for (uint32_t k : bin) {
+        uint32_t id = queue.path[k];
+        thread_rng().start_path(seed, pathPixel[id], pathSample[id],
+                              sampler.get());
+        thread_rng().start_bounce(bounce);
+
+        Ray<T> scattered;
+        Vec3<T> attenuation;
+        if (!scatter(materials[recs[k].matId], queue.ray(k), recs[k],
+                     attenuation, scattered)) {
+          count_path_end(PathEnd::Absorbed, bounce);
+          continue;
+        }
+        Vec3<T> throughput = queue.throughput[k] * attenuation;
+        if (survive_roulette(throughput, bounce))
+          next.push(scattered, throughput, id);
+        else
+          count_path_end(PathEnd::Roulette, bounce);
+      }
+    }
+    std::swap(queue, next);
+  }
+  for (size_t k = 0; k < queue.size(); ++k)
+    count_path_end(PathEnd::DepthLimit, maxDepth);
+
+  // Paths are numbered in sample order, so this sums each pixel's samples
+  // in the same order render_tile does.
+  for (uint32_t id = 0; id < nPaths; ++id)
+    add_sample(pathPixel[id], Color(radiance[id]));
+}
+
+template void Image::render_tile_wavefront(const Tile &, const Camera<float> &,
+                                           const Hittable<float> &,
+                                           const MaterialTable<float> &, int,
+                                           WavefrontStats &);
+template void Image::render_tile_wavefront(const Tile &,
+                                           const Camera<double> &,
+                                           const Hittable<double> &,
+                                           const MaterialTable<double> &, int,
+                                           WavefrontStats &);
@@ -1,63 +1,81 @@
+#include "BVH.h"
 #include "Camera.h"
+#include "Checkpoint.h"
 #include "Color.h"
 #include "HittableList.h"
 #include "Image.h"
+#include "ImageWriter.h"
+#include "LinearBVH.h"
 #include "Material.h"
 #include "RTWeekend.h"
 #include "Ray.h"
+#include "RayStats.h"
+#include "Scenes.h"
 #include "Sphere.h"
+#include "SphereSoA.h"
 #include "Vec3.h"
+#include "WideBVH.h"
 #include "cxxopts.hpp"
 #include <CL/cl.h>
+#include <chrono>
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
 
-HittableList random_scene() {
-  HittableList world;
-
-  auto ground_material = std::make_shared<Lambertian>(Color(0.5, 0.5, 0.5));
-  world.add(
-      std::make_shared<Sphere>(Point3(0, -1000, 0), 1000, ground_material));
-
-  for (int a = -11; a < 11; a++) {
-    for (int b = -11; b < 11; b++) {
-      auto choose_mat = random_dbl();
-      Point3 center(a + 0.9 * random_dbl(), 0.2, b + 0.9 * random_dbl());
-
-      if ((center - Point3(4, 0.2, 0)).length() > 0.9) {
-        std::shared_ptr<Material> sphere_material;
-
-        if (choose_mat < 0.8) {
-          // diffuse
-          auto albedo = Color::rand() * Color::rand();
-          sphere_material = std::make_shared<Lambertian>(albedo);
-          world.add(std::make_shared<Sphere>(center, 0.2, sphere_material));
-        } else if (choose_mat < 0.95) {
-          // metal
-          auto albedo = Color::rand(0.5, 1);
-          auto fuzz = random_dbl(0, 0.5);
-          sphere_material = std::make_shared<Metal>(albedo, fuzz);
-          world.add(std::make_shared<Sphere>(center, 0.2, sphere_material));
-        } else {
-          // glass
-          sphere_material = std::make_shared<Dielectric>(1.5);
-          world.add(std::make_shared<Sphere>(center, 0.2, sphere_material));
-        }
-      }
-    }
+/// Build the acceleration structure called name over world, or return
+/// nullptr if there is no such structure.
+template <typename T>
+std::shared_ptr<Hittable<T>> build_accel(const std::string &name,
+                                         const HittableList<T> &world) {
+  if (name == "bvh4") {
+    auto bvh = std::make_shared<BVH4<T>>(world);
+    std::cerr << "Box test kernel: " << wide_kernel_name(bvh->kernel())
+              << '\n';
+    return bvh;
   }
+  if (name == "bvh8") {
+    auto bvh = std::make_shared<BVH8<T>>(world);
+    std::cerr << "Box test kernel: " << wide_kernel_name(bvh->kernel())
+              << '\n';
+    return bvh;
+  }
+  if (name == "lbvh")
+    return std::make_shared<LinearBVH<T>>(world);
+  if (name == "bvh")
+    return build_bvh(world);
+  if (name == "soa")
+    return std::make_shared<SphereSoA<T>>(world);
+  if (name == "list")
+    return std::make_shared<HittableList<T>>(world);
+  return nullptr;
+}
 
-  auto material1 = std::make_shared<Dielectric>(1.5);
-  world.add(std::make_shared<Sphere>(Point3(0, 1, 0), 1.0, material1));
-
-  auto material2 = std::make_shared<Lambertian>(Color(0.4, 0.2, 0.1));
-  world.add(std::make_shared<Sphere>(Point3(-4, 1, 0), 1.0, material2));
+/// Build the scene called sceneName in precision T and render it into img.
+template <typename T>
+int render_scene(Image &img, const std::string &sceneName,
+                 const std::string &accelName) {
+  // World
+  MaterialTable<T> materials;
+  HittableList<T> world;
+  if (!build_scene(sceneName, materials, world)) {
+    std::cerr << "Unknown scene: " << sceneName << '\n';
+    return 1;
+  }
+  // Group materials by type so shading walks each kind contiguously.
+  remap_materials(world, materials.sort_by_type());
+  auto accel = build_accel(accelName, world);
+  if (!accel) {
+    std::cerr << "Unknown acceleration structure: " << accelName << '\n';
+    return 1;
+  }
 
-  auto material3 = std::make_shared<Metal>(Color(0.7, 0.6, 0.5), 0.0);
-  world.add(std::make_shared<Sphere>(Point3(4, 1, 0), 1.0, material3));
+  // Set up camera
+  auto cam = scene_camera(sceneName, T(img.aspectRatio));
 
-  return world;
+  // Render scene
+  img.printInfo();
+  img.render(cam, *accel, materials, 50);
+  return 0;
 }
 
 int main(int argc, const char** argv){
@@ -78,9 +96,69 @@ int main(int argc, const char** argv){
   opts.add_options()("h,help", "Print usage")(
       "o,output", "Write output to ",
       cxxopts::value<std::string>()->default_value("render.ppm"))(
+      "format", "Output format: auto|p3|p6|png|pfm (auto picks by the "
+                "--output extension; .ppm is P6)",
+      cxxopts::value<std::string>()->default_value("auto"))(
+      "stream", "Write P6/PFM rows while rendering, keeping only a band of "
+                "rows in memory (for very large images)",
+      cxxopts::value<bool>()->default_value("false"))(
+      "stream-memory", "Megabytes of accumulation buffers per band when "
+                       "streaming",
+      cxxopts::value<int>()->default_value("256"))(
       "s,spp", "Samples per pixel", cxxopts::value<int>()->default_value("30"))(
       "w,width", "Set width of the render",
-      cxxopts::value<int>()->default_value("960"));
+      cxxopts::value<int>()->default_value("960"))(
+      "t,threads", "Number of render threads (0 = all cores)",
+      cxxopts::value<int>()->default_value("0"))(
+      "tile-size", "Edge length of a render tile in pixels",
+      cxxopts::value<int>()->default_value("16"))(
+      "seed", "Seed of the per-pixel random streams",
+      cxxopts::value<uint64_t>()->default_value("0"))(
+      "rr-depth", "Bounces before Russian roulette starts ending paths",
+      cxxopts::value<int>()->default_value("3"))(
+      "packets", "Trace camera rays in packets of 8 (true|false)",
+      cxxopts::value<bool>()->default_value("true"))(
+      "wavefront", "Trace each tile breadth first, one bounce at a time",
+      cxxopts::value<bool>()->default_value("false"))(
+      "sort-rays", "Sort secondary rays by octant and origin (implies "
+                   "--wavefront)",
+      cxxopts::value<bool>()->default_value("false"))(
+      "noise-threshold",
+      "Stop sampling a pixel once the standard error of its displayed value "
+      "is below this (0-1 scale, 0 = always take --spp samples)",
+      cxxopts::value<double>()->default_value("0"))(
+      "min-spp", "Samples every pixel takes before adaptive sampling may stop",
+      cxxopts::value<int>()->default_value("16"))(
+      "time-budget",
+      "Render 1 spp passes until this many seconds are used up (--spp, if "
+      "given, still caps the samples)",
+      cxxopts::value<double>()->default_value("0"))(
+      "spp-map", "Also write the samples taken per pixel to this PPM",
+      cxxopts::value<std::string>())(
+      "checkpoint", "Periodically save the render state to this file",
+      cxxopts::value<std::string>())(
+      "checkpoint-interval", "Seconds between checkpoints",
+      cxxopts::value<double>()->default_value("60"))(
+      "resume", "Continue the render saved in this checkpoint (and keep "
+                "checkpointing to it unless --checkpoint is given)",
+      cxxopts::value<std::string>())(
+      "progress", "Progress reports: text (stderr) or json (one object "
+                  "per line on stdout)",
+      cxxopts::value<std::string>()->default_value("text"))(
+      "q,quiet", "Print no progress reports or scheduler statistics",
+      cxxopts::value<bool>()->default_value("false"))(
+      "stats", "Print ray statistics (builds with FRT_RAY_STATS only)",
+      cxxopts::value<bool>()->default_value("false"))(
+      "stats-json", "Write ray statistics as JSON to this file",
+      cxxopts::value<std::string>())(
+      "sampler", "Sample generator: random|stratified|sobol|bluenoise",
+      cxxopts::value<std::string>()->default_value("sobol"))(
+      "scene", "Scene: random|field (100k spheres)|glass",
+      cxxopts::value<std::string>()->default_value("random"))(
+      "accel", "Acceleration structure: list|soa|bvh|lbvh|bvh4|bvh8",
+      cxxopts::value<std::string>()->default_value("lbvh"))(
+      "precision", "Arithmetic used for tracing: float|double",
+      cxxopts::value<std::string>()->default_value("double"));
 
   // Parse commandline options
   auto result = opts.parse(argc, argv);
@@ -91,27 +169,161 @@ int main(int argc, const char** argv){
   if (result.count("spp")) {
     img.samplesPerPixel = result["spp"].as<int>();
   }
+  img.threads = result["threads"].as<int>();
+  img.tileSize = result["tile-size"].as<int>();
+  img.seed = result["seed"].as<uint64_t>();
+  img.rrMinDepth = result["rr-depth"].as<int>();
+  img.packets = result["packets"].as<bool>();
+  img.wavefront = result["wavefront"].as<bool>();
+  img.sortRays = result["sort-rays"].as<bool>();
+  // Sorting works on the wavefront's ray queues.
+  if (img.sortRays)
+    img.wavefront = true;
+  img.noiseThreshold = result["noise-threshold"].as<double>();
+  img.minSamples = result["min-spp"].as<int>();
+  img.timeBudget = result["time-budget"].as<double>();
+  // Adaptive and progressive renders stop at --spp, except that under a
+  // deadline without --spp the budget alone ends the render.
+  if (img.timeBudget <= 0 || result.count("spp"))
+    img.sampleCap = img.samplesPerPixel;
   if (result.count("width")) {
     img.width = result["width"].as<int>();
     img.height = static_cast<int>(img.width / img.aspectRatio);
   }
+  const bool stats = result["stats"].as<bool>() || result.count("stats-json");
+  if (stats && !rayStatsEnabled) {
+    std::cerr << "Ray statistics are not compiled into this build; use "
+                 "raytracer_stats or configure with -DFRT_RAY_STATS=ON\n";
+    return 1;
+  }
+  auto progressName = result["progress"].as<std::string>();
+  if (result["quiet"].as<bool>())
+    img.progressStyle = ProgressStyle::Quiet;
+  else if (progressName == "json")
+    img.progressStyle = ProgressStyle::Json;
+  else if (progressName != "text") {
+    std::cerr << "Unknown progress style: " << progressName << '\n';
+    return 1;
+  }
+  auto samplerName = result["sampler"].as<std::string>();
+  // The strata are laid out for a known sample count.
+  if (samplerName == "stratified" && img.timeBudget > 0 &&
+      img.sampleCap == Image::noSampleCap) {
+    std::cerr << "--sampler=stratified with --time-budget needs --spp\n";
+    return 1;
+  }
+  img.sampler =
+      make_sampler(samplerName, img.samplesPerPixel, img.width, img.seed);
+  if (!img.sampler) {
+    std::cerr << "Unknown sampler: " << samplerName << '\n';
+    return 1;
+  }
 
-  // Create the output img file
-  std::ofstream outputFile(result["output"].as<std::string>(), std::ios::out);
+  // Everything that changes the samples; a resumed render must match.
+  img.renderSettings =
+      "spp=" +
+      (img.timeBudget > 0 && img.sampleCap == Image::noSampleCap
+           ? std::string("none")
+           : std::to_string(img.samplesPerPixel)) +
+      " seed=" + std::to_string(img.seed) + " sampler=" + samplerName +
+      " scene=" + result["scene"].as<std::string>() +
+      " precision=" + result["precision"].as<std::string>() +
+      " accel=" + result["accel"].as<std::string>() +
+      " rr-depth=" + std::to_string(img.rrMinDepth) +
+      " noise-threshold=" + std::to_string(img.noiseThreshold) +
+      " min-spp=" + std::to_string(img.minSamples);
+  img.checkpointInterval = result["checkpoint-interval"].as<double>();
+  if (img.checkpointInterval <= 0) {
+    std::cerr << "--checkpoint-interval must be positive\n";
+    return 1;
+  }
+  if (result.count("resume")) {
+    auto resumeFile = result["resume"].as<std::string>();
+    if (!load_checkpoint(resumeFile, img))
+      return 1;
+    img.checkpointFile = resumeFile;
+  }
+  if (result.count("checkpoint"))
+    img.checkpointFile = result["checkpoint"].as<std::string>();
 
-  // World
-  auto world = random_scene();
+  // Create the output img file
+  auto outputName = result["output"].as<std::string>();
+  auto writer =
+      make_image_writer(result["format"].as<std::string>(), outputName);
+  if (!writer) {
+    std::cerr << "Unknown output format for " << outputName << '\n';
+    return 1;
+  }
+  std::unique_ptr<StreamingOutput> stream;
+  std::ofstream outputFile;
+  if (result["stream"].as<bool>()) {
+    // Bands are finished one after another, which rules out anything that
+    // needs the whole image at once.
+    auto rows = dynamic_cast<const RowWriter *>(writer.get());
+    if (!rows) {
+      std::cerr << "--stream needs P6 or PFM output\n";
+      return 1;
+    }
+    if (img.timeBudget > 0 || !img.checkpointFile.empty() ||
+        result.count("spp-map")) {
+      std::cerr << "--stream cannot be combined with --time-budget, "
+                   "--checkpoint, --resume or --spp-map\n";
+      return 1;
+    }
+    stream = std::make_unique<StreamingOutput>(*rows, outputName, img.width,
+                                               img.height);
+    if (!stream->ok()) {
+      std::cerr << "Could not create " << outputName << '\n';
+      return 1;
+    }
+    img.stream = stream.get();
+    img.streamMemory = size_t(result["stream-memory"].as<int>()) << 20;
+  } else {
+    outputFile.open(outputName, std::ios::out | std::ios::binary);
+  }
 
-  // Set up camera
-  Camera cam(/*lookfrom*/ Point3(13., 2., 3.),
-             /*lookat*/ Point3(0., 0., 0.), /*vup*/ Vec3(0., 1., 0.), 20,
-             img.aspectRatio, 0.1, 10.0);
+  auto precision = result["precision"].as<std::string>();
+  const auto renderStart = std::chrono::steady_clock::now();
+  int status;
+  if (precision == "float") {
+    status = render_scene<float>(img, result["scene"].as<std::string>(),
+                                 result["accel"].as<std::string>());
+  } else if (precision == "double") {
+    status = render_scene<double>(img, result["scene"].as<std::string>(),
+                                  result["accel"].as<std::string>());
+  } else {
+    std::cerr << "Unknown precision: " << precision << '\n';
+    return 1;
+  }
+  if (status != 0)
+    return status;
+  if (stats || img.progressStyle == ProgressStyle::Text)
+    print_scheduler_stats(img.schedulerStats);
+  if (stats) {
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - renderStart)
+                         .count();
+    RayStats rayStats = collect_ray_stats();
+    if (result["stats"].as<bool>())
+      print_ray_stats(std::cerr, rayStats, seconds);
+    if (result.count("stats-json")) {
+      std::ofstream statsFile(result["stats-json"].as<std::string>());
+      write_ray_stats_json(statsFile, rayStats, seconds);
+    }
+  }
 
-  // Render scene
-  img.printInfo();
-  img.render(cam, world, 50);
-  outputFile << img;
-  std::cerr << "\nImage file " << result["output"].as<std::string>()
-            << " was created.\n";
+  if (stream) {
+    if (!stream->ok()) {
+      std::cerr << "\nCould not write " << outputName << '\n';
+      return 1;
+    }
+  } else {
+    writer->write(outputFile, img);
+  }
+  if (result.count("spp-map")) {
+    std::ofstream mapFile(result["spp-map"].as<std::string>());
+    write_sample_map(mapFile, img);
+  }
+  std::cerr << "\nImage file " << outputName << " was created.\n";
   return 0;
 }